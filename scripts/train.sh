@@ -1,18 +1,8 @@
 #!/usr/bin/env bash
 
-while true; do
-    GEN=$(<gen)
-    NEWGEN=$(( $GEN + 1 ))
-
-    date | tee -a train.log
-    echo "$(tput bold)(train.sh) Training gen $NEWGEN$(tput sgr0)" | tee -a train.log
-    ./main train | tee -a train.log
-
-    date | tee -a train.log
-    echo "$(tput bold)(train.sh) Done training gen $NEWGEN$(tput sgr0)" | tee -a train.log
-
-    echo "$NEWGEN" > gen
-
-    cp "net.pt" "net.$NEWGEN.pt"
-    cp "opt.pt" "opt.$NEWGEN.pt"
-done
+# ./main loop keeps the model loaded across generations, counts generations
+# through the replay buffer and writes net.N.pt/opt.N.pt itself. Set
+# PIPELINE=1 to keep self-play running while the network trains.
+date | tee -a train.log
+echo "$(tput bold)(train.sh) Starting training loop$(tput sgr0)" | tee -a train.log
+./main loop | tee -a train.log
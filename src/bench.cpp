@@ -0,0 +1,209 @@
+// Microbenchmarks, printed as one JSON object per line so that runs can be
+// diffed between commits. Timings are per operation, over BENCH_REPS
+// repetitions after BENCH_WARMUP untimed ones. BENCH_FILTER runs only the
+// benchmarks whose name contains it.
+#include "game.hpp"
+#include "mcts.hpp"
+#include "model.hpp"
+#include "rng.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include <fmt/core.h>
+
+namespace {
+int env_int(const char* name, int fallback) {
+    const char* value = std::getenv(name);
+    return value ? std::atoi(value) : fallback;
+}
+
+const int REPS = std::max(1, env_int("BENCH_REPS", 20));
+const int WARMUP = std::max(0, env_int("BENCH_WARMUP", 3));
+const char* FILTER = std::getenv("BENCH_FILTER");
+
+// keeps results alive so that the compiler can't drop the benchmarked work
+volatile uint64_t sink = 0;
+
+double percentile(const std::vector<double>& sorted, double p) {
+    double rank = p * (sorted.size() - 1);
+    size_t lo = static_cast<size_t>(rank);
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+// times body, which performs ops operations per call, and prints the
+// nanoseconds per operation
+template <typename F>
+void run(const std::string& name, int64_t ops, F&& body) {
+    if (FILTER && name.find(FILTER) == std::string::npos) {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    using Nanos = std::chrono::duration<double, std::nano>;
+
+    for (int r = 0; r < WARMUP; r += 1) {
+        body();
+    }
+    std::vector<double> per_op{};
+    for (int r = 0; r < REPS; r += 1) {
+        auto start = Clock::now();
+        body();
+        per_op.push_back(Nanos(Clock::now() - start).count() / ops);
+    }
+    std::sort(per_op.begin(), per_op.end());
+    double mean = 0.0;
+    for (double t : per_op) {
+        mean += t / per_op.size();
+    }
+
+    double p50 = percentile(per_op, 0.5);
+    fmt::print("{{\"name\": \"{}\", \"reps\": {}, \"ops\": {}, "
+               "\"ns_per_op\": {{\"min\": {:.1f}, \"p50\": {:.1f}, "
+               "\"p90\": {:.1f}, \"p99\": {:.1f}, \"mean\": {:.1f}}}, "
+               "\"ops_per_sec\": {:.1f}}}\n",
+               name, REPS, ops, per_op.front(), p50,
+               percentile(per_op, 0.9), percentile(per_op, 0.99), mean,
+               1e9 / p50);
+    std::fflush(stdout);
+}
+
+// move sequences of finished random games
+std::vector<std::vector<Action>> random_games(int count, Rng& rng) {
+    std::vector<std::vector<Action>> games{};
+    for (int g = 0; g < count; g += 1) {
+        std::vector<Action> moves{};
+        State state{};
+        while (state.is_ended() == false) {
+            auto actions = state.get_actions();
+            Action action = actions[rng.below(actions.size())];
+            state.place(action);
+            moves.push_back(action);
+        }
+        games.push_back(moves);
+    }
+    return games;
+}
+
+void bench_state(Rng& rng) {
+    auto games = random_games(1000, rng);
+    std::vector<State> positions{};
+    int64_t moves = 0;
+    for (auto& game : games) {
+        State state{};
+        for (Action action : game) {
+            positions.push_back(state);
+            state.place(action);
+        }
+        moves += game.size();
+    }
+    int64_t count = positions.size();
+
+    run("state.place", moves, [&] {
+        for (auto& game : games) {
+            State state{};
+            for (Action action : game) {
+                state.place(action);
+            }
+            sink = sink + state.get_hash();
+        }
+    });
+    run("state.get_actions", count, [&] {
+        for (const State& state : positions) {
+            sink = sink + state.get_actions().size();
+        }
+    });
+    run("state.canonical", count, [&] {
+        for (const State& state : positions) {
+            sink = sink + static_cast<uint64_t>(state.canonical()[2][3]);
+        }
+    });
+    std::vector<float> planes(INPUT_PLANES * BOARD_CELLS);
+    run("state.write_planes", count, [&] {
+        for (const State& state : positions) {
+            state.write_planes(planes.data());
+            sink = sink + static_cast<uint64_t>(planes[BOARD_CELLS + 3]);
+        }
+    });
+}
+
+void bench_search(Rng& rng) {
+    constexpr int PLAYOUTS = 1000;
+    run("mcts.random_playout", PLAYOUTS, [&] {
+        for (int n = 0; n < PLAYOUTS; n += 1) {
+            State state{};
+            sink = sink + random_playout(state, rng);
+        }
+    });
+
+    // playouts of a query from the empty board, on a fresh tree every time.
+    // Nothing may cut the query short, so it runs exactly iters of them.
+    for (int iters : {1000, 5000, 20000}) {
+        run(fmt::format("mcts.query.iters{}", iters), iters, [&] {
+            Mcts mcts{1};
+            mcts.set_iters(iters);
+            mcts.set_move_time(0);
+            mcts.set_early_stop(false);
+            mcts.set_book(nullptr);
+            mcts.seed(rng());
+            sink = sink + mcts.query(State{}).first.cell();
+        });
+    }
+}
+
+void bench_net(Rng& rng) {
+    torch::manual_seed(rng());
+    torch::NoGradGuard no_grad;
+    Net net{};
+    net->to(torch::kCPU);
+    net->eval();
+
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    // latency of one forward call
+    for (int batch : {1, 8, 64, 256}) {
+        auto input = torch::randint(
+            -1, 2, {batch, 1, BOARD_SIZE, BOARD_SIZE}, options);
+        run(fmt::format("net.forward.batch{}", batch), 1, [&] {
+            sink = sink + net->forward(input).size(0);
+        });
+    }
+}
+
+void bench_train(Rng& rng) {
+    torch::manual_seed(rng());
+    Net net{};
+    net->to(torch::kCPU);
+    torch::optim::Adam opt(net->parameters(),
+                           torch::optim::AdamOptions(1e-4));
+
+    constexpr int BATCH = 64;
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    auto states =
+        torch::randint(-1, 2, {BATCH, 1, BOARD_SIZE, BOARD_SIZE}, options);
+    auto policies = torch::softmax(torch::randn({BATCH, BOARD_CELLS}), 1);
+    run(fmt::format("train.step.batch{}", BATCH), 1, [&] {
+        net->zero_grad();
+        auto loss = -(net->forward(states) * policies).sum(1).mean();
+        loss.backward();
+        opt.step();
+    });
+}
+} // namespace
+
+int main() {
+    // same workload on every run
+    Rng rng{static_cast<uint64_t>(env_int("SEED", 42))};
+    // single threaded, as intra-op threads make the timings noisy
+    torch::set_num_threads(1);
+
+    bench_state(rng);
+    bench_search(rng);
+    bench_net(rng);
+    bench_train(rng);
+    return EXIT_SUCCESS;
+}
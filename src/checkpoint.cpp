@@ -0,0 +1,75 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <fmt/color.h>
+#include <fmt/core.h>
+
+namespace {
+// writes bytes to path.tmp, syncs it and renames it over path
+bool write_file(const std::string& path, const std::string& bytes) {
+    std::string tmp = path + ".tmp";
+    FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) ==
+                  bytes.size() &&
+              std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+} // namespace
+
+Checkpointer::Checkpointer() : worker([this] { run(); }) {}
+
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    worker.join();
+}
+
+void Checkpointer::save(Net net, torch::optim::Adam& opt, int generation) {
+    std::ostringstream net_bytes;
+    std::ostringstream opt_bytes;
+    torch::save(net, net_bytes);
+    torch::save(opt, opt_bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({generation, net_bytes.str(), opt_bytes.str()});
+    }
+    cv.notify_one();
+}
+
+void Checkpointer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) {
+            return;
+        }
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+
+        bool ok =
+            write_file(fmt::format("net.{}.pt", job.generation), job.net) &&
+            write_file(fmt::format("opt.{}.pt", job.generation), job.opt) &&
+            write_file("net.pt", job.net) && write_file("opt.pt", job.opt);
+        if (ok) {
+            fmt::print("Saved checkpoint of generation {}\n", job.generation);
+        } else {
+            fmt::print(stderr, fmt::fg(fmt::color::red),
+                       "Failed to save checkpoint of generation {}\n",
+                       job.generation);
+        }
+
+        lock.lock();
+    }
+}
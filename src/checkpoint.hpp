@@ -0,0 +1,40 @@
+#pragma once
+
+#include "model.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <torch/torch.h>
+
+// Writes versioned checkpoints from a background thread. The model and
+// optimizer are serialized into memory on the calling thread, so training
+// can go on while the files are written.
+class Checkpointer {
+  public:
+    Checkpointer();
+    // finishes the pending writes
+    ~Checkpointer();
+
+    // net.{generation}.pt and opt.{generation}.pt, then net.pt and opt.pt.
+    // Every file is replaced atomically through a rename.
+    void save(Net net, torch::optim::Adam& opt, int generation);
+
+  private:
+    struct Job {
+        int generation;
+        std::string net;
+        std::string opt;
+    };
+
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    bool stopping = false;
+    std::thread worker;
+};
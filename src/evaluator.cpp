@@ -0,0 +1,238 @@
+#include "evaluator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <string>
+
+#include <fmt/core.h>
+
+NetEvaluator::NetEvaluator(Net net)
+    : net(net), device(net->parameters().front().device()) {}
+
+Policy NetEvaluator::evaluate(const State& state) {
+    torch::NoGradGuard no_grad;
+
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    auto input = torch::empty({1, 1, BOARD_SIZE, BOARD_SIZE}, options);
+    state.write_board(input.data_ptr<float>());
+
+    return policy_from_tensor(net->forward(input.to(device)).exp());
+}
+
+BatchEvaluator::BatchEvaluator(Net net, int max_batch,
+                               std::chrono::microseconds deadline)
+    : net(net), device(net->parameters().front().device()),
+      max_batch(std::max(1, max_batch)), deadline(deadline),
+      batch_sizes(this->max_batch + 1, 0), worker([this] { run(); }) {}
+
+BatchEvaluator::~BatchEvaluator() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+}
+
+Policy BatchEvaluator::evaluate(const State& state) {
+    std::future<Policy> result;
+    bool notify;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(Request{state, {}, Clock::now()});
+        result = pending.back().promise.get_future();
+        // the worker only cares about the first request and a full batch
+        notify = pending.size() == 1 ||
+                 static_cast<int>(pending.size()) >= max_batch;
+    }
+    if (notify) {
+        wakeup.notify_one();
+    }
+    return result.get();
+}
+
+void BatchEvaluator::run() {
+    std::vector<Request> batch{};
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            // stopping with nothing left to do
+            return;
+        }
+
+        // wait for a full batch, or until the oldest request is due
+        auto due = pending.front().queued + deadline;
+        wakeup.wait_until(lock, due, [this] {
+            return stopping || static_cast<int>(pending.size()) >= max_batch;
+        });
+
+        size_t count = std::min(pending.size(), static_cast<size_t>(max_batch));
+        batch.clear();
+        std::move(pending.begin(), pending.begin() + count,
+                  std::back_inserter(batch));
+        pending.erase(pending.begin(), pending.begin() + count);
+
+        lock.unlock();
+        run_batch(batch);
+        lock.lock();
+    }
+}
+
+void BatchEvaluator::run_batch(std::vector<Request>& batch) {
+    auto start = Clock::now();
+    int64_t size = static_cast<int64_t>(batch.size());
+
+    try {
+        torch::NoGradGuard no_grad;
+
+        // positions are written straight into the input tensor
+        auto options = torch::TensorOptions().dtype(torch::kFloat32);
+        auto input = torch::empty({size, 1, BOARD_SIZE, BOARD_SIZE}, options);
+        float* data = input.data_ptr<float>();
+        for (int64_t i = 0; i < size; i += 1) {
+            batch[i].state.write_board(data + i * BOARD_CELLS);
+        }
+
+        auto output = net->forward(input.to(device)).exp().to(torch::kCPU);
+        const float* policies = output.data_ptr<float>();
+        for (int64_t i = 0; i < size; i += 1) {
+            Policy policy;
+            std::memcpy(policy.data(), policies + i * BOARD_CELLS,
+                        sizeof(Policy));
+            batch[i].promise.set_value(policy);
+        }
+    } catch (...) {
+        for (auto& request : batch) {
+            request.promise.set_exception(std::current_exception());
+        }
+    }
+
+    auto end = Clock::now();
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    batch_sizes[size] += 1;
+    requests += size;
+    total_forward += end - start;
+    for (auto& request : batch) {
+        auto wait = start - request.queued;
+        total_wait += wait;
+        max_wait = std::max(max_wait, wait);
+    }
+}
+
+void BatchEvaluator::report() const {
+    using std::chrono::duration;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    uint64_t batches = 0;
+    for (auto count : batch_sizes) {
+        batches += count;
+    }
+    if (batches == 0) {
+        fmt::print("Batch evaluator: no requests\n");
+        return;
+    }
+
+    double forward_s = duration<double>(total_forward).count();
+    fmt::print("Batch evaluator: {} requests in {} batches "
+               "(mean batch {:.2f}, max {})\n",
+               requests, batches, static_cast<double>(requests) / batches,
+               max_batch);
+    fmt::print("  queue wait mean {:.1f} us, max {:.1f} us\n",
+               duration<double, std::micro>(total_wait).count() / requests,
+               duration<double, std::micro>(max_wait).count());
+    fmt::print("  forward {:.1f} us per batch, {:.0f} positions/sec\n",
+               1e6 * forward_s / batches, requests / forward_s);
+    fmt::print("  batch sizes:\n");
+    for (size_t size = 1; size < batch_sizes.size(); size += 1) {
+        if (batch_sizes[size] != 0) {
+            fmt::print("  {:4}: {}\n", size, batch_sizes[size]);
+        }
+    }
+}
+
+CachedEvaluator::CachedEvaluator(std::shared_ptr<Evaluator> inner,
+                                 size_t capacity, Eviction eviction)
+    : inner(std::move(inner)),
+      shard_capacity(std::max<size_t>(1, capacity / SHARDS)),
+      eviction(eviction) {}
+
+size_t CachedEvaluator::KeyHash::operator()(const Key& key) const {
+    uint64_t h = fold_bits(key.mine) * 0x9e3779b97f4a7c15ull;
+    h ^= fold_bits(key.theirs) + 0x7f4a7c159e3779b9ull + (h << 6) + (h >> 2);
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+Policy CachedEvaluator::evaluate(const State& state) {
+    Player me = state.get_next();
+    Key key{state.get_stones(me), state.get_stones(!me)};
+    Shard& shard = shards[KeyHash{}(key) % SHARDS];
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            hits += 1;
+            if (eviction == Eviction::Lru) {
+                shard.entries.splice(shard.entries.begin(), shard.entries,
+                                     found->second);
+            }
+            return found->second->second;
+        }
+    }
+
+    // evaluate without holding the lock; racing misses on the same position
+    // just evaluate it twice
+    auto start = std::chrono::steady_clock::now();
+    Policy policy = inner->evaluate(state);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    miss_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    misses += 1;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.count(key) == 0) {
+        shard.entries.emplace_front(key, policy);
+        shard.index.emplace(key, shard.entries.begin());
+        if (shard.entries.size() > shard_capacity) {
+            shard.index.erase(shard.entries.back().first);
+            shard.entries.pop_back();
+            evictions += 1;
+        }
+    }
+    return policy;
+}
+
+void CachedEvaluator::report() const {
+    uint64_t total = hits + misses;
+    double hit_rate = (total != 0) ? static_cast<double>(hits) / total : 0.0;
+    // every hit saves about one average miss
+    double miss_us = (misses != 0) ? miss_ns / 1e3 / misses : 0.0;
+    fmt::print("Evaluation cache ({}, {} entries): {} hits, {} misses, "
+               "{} evictions\n",
+               (eviction == Eviction::Lru) ? "lru" : "fifo",
+               shard_capacity * SHARDS, hits.load(), misses.load(),
+               evictions.load());
+    fmt::print("  hit rate {:.1f}%, saved about {:.3f} s of inference\n",
+               100.0 * hit_rate, hits * miss_us / 1e6);
+    inner->report();
+}
+
+std::shared_ptr<Evaluator> cached_evaluator(std::shared_ptr<Evaluator> inner) {
+    const char* cache_s = std::getenv("EVAL_CACHE");
+    int cache = cache_s ? std::atoi(cache_s) : 65536;
+    if (cache <= 0) {
+        fmt::print("Using EVAL_CACHE = 0\n");
+        return inner;
+    }
+    const char* policy_s = std::getenv("EVAL_CACHE_POLICY");
+    std::string policy = policy_s ? policy_s : "lru";
+    auto eviction = (policy == "fifo") ? CachedEvaluator::Eviction::Fifo
+                                       : CachedEvaluator::Eviction::Lru;
+    fmt::print("Using EVAL_CACHE = {} ({})\n", cache, policy);
+    return std::make_shared<CachedEvaluator>(std::move(inner), cache,
+                                             eviction);
+}
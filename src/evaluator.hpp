@@ -0,0 +1,133 @@
+#pragma once
+
+#include "game.hpp"
+#include "model.hpp"
+#include "tensor_utils.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <torch/torch.h>
+
+// Source of move priors for the search. Implementations must be safe to call
+// from several threads at once.
+class Evaluator {
+  public:
+    virtual ~Evaluator() = default;
+    // move probabilities over all cells, as seen by the player to move
+    virtual Policy evaluate(const State& state) = 0;
+    // print statistics gathered so far
+    virtual void report() const {}
+};
+
+// Runs the network directly, one position at a time
+class NetEvaluator : public Evaluator {
+  public:
+    // net has to be on its final device already
+    NetEvaluator(Net net);
+    Policy evaluate(const State& state) override;
+
+  private:
+    Net net;
+    torch::Device device;
+};
+
+// Gathers positions from all calling threads into batches for the network.
+// A batch is run once it holds max_batch positions, or once its oldest
+// position has waited for deadline.
+class BatchEvaluator : public Evaluator {
+  public:
+    // net has to be on its final device already
+    BatchEvaluator(Net net, int max_batch, std::chrono::microseconds deadline);
+    ~BatchEvaluator();
+    Policy evaluate(const State& state) override;
+    void report() const override;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    struct Request {
+        State state;
+        std::promise<Policy> promise;
+        Clock::time_point queued;
+    };
+
+    // worker loop, runs until stopping is set
+    void run();
+    void run_batch(std::vector<Request>& batch);
+
+    Net net;
+    torch::Device device;
+    int max_batch;
+    std::chrono::microseconds deadline;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<Request> pending{};
+    bool stopping = false;
+
+    // statistics, guarded by stats_mutex
+    mutable std::mutex stats_mutex;
+    std::vector<uint64_t> batch_sizes;
+    uint64_t requests = 0;
+    std::chrono::nanoseconds total_wait{0};
+    std::chrono::nanoseconds max_wait{0};
+    std::chrono::nanoseconds total_forward{0};
+
+    std::thread worker;
+};
+
+// Bounded memo of another evaluator, keyed by the canonical position (stones
+// of the player to move and of the opponent). Split into shards with their
+// own lock, each evicting by the chosen policy once full.
+class CachedEvaluator : public Evaluator {
+  public:
+    enum class Eviction { Lru, Fifo };
+
+    CachedEvaluator(std::shared_ptr<Evaluator> inner, size_t capacity,
+                    Eviction eviction);
+    Policy evaluate(const State& state) override;
+    void report() const override;
+
+  private:
+    struct Key {
+        Bitboard mine;
+        Bitboard theirs;
+        bool operator==(const Key& rhs) const {
+            return mine == rhs.mine && theirs == rhs.theirs;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    struct Shard {
+        std::mutex mutex;
+        // most recently inserted (or used, for LRU) first
+        std::list<std::pair<Key, Policy>> entries;
+        std::unordered_map<Key, decltype(entries)::iterator, KeyHash> index;
+    };
+    static constexpr size_t SHARDS = 16;
+
+    std::shared_ptr<Evaluator> inner;
+    size_t shard_capacity;
+    Eviction eviction;
+    std::array<Shard, SHARDS> shards;
+
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+    // time spent in the inner evaluator on misses
+    std::atomic<int64_t> miss_ns = 0;
+};
+
+// inner memoized by a CachedEvaluator of EVAL_CACHE entries (65536 by
+// default, 0 turns it off) evicting by EVAL_CACHE_POLICY, lru or fifo
+std::shared_ptr<Evaluator> cached_evaluator(std::shared_ptr<Evaluator> inner);
@@ -0,0 +1,242 @@
+#include "fast_net.hpp"
+#include "net_common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAST_NET_X86 1
+#endif
+
+namespace {
+using net_common::bordered;
+using net_common::CELLS;
+using net_common::cpu_values;
+using net_common::log_softmax;
+using net_common::TAP_OFFSET;
+} // namespace
+
+FastNet::FastNet(Net net) {
+    auto params = net->named_parameters();
+    auto conv1_w = cpu_values(params["conv1.weight"]);
+    auto conv1_b = cpu_values(params["conv1.bias"]);
+    auto conv2_w = cpu_values(params["conv2.weight"]);
+    auto conv2_b = cpu_values(params["conv2.bias"]);
+    auto conv3_w = cpu_values(params["conv3.weight"]);
+    auto conv3_b = cpu_values(params["conv3.bias"]);
+
+    // torch keeps [out][in][kh][kw], and the tap index is kh * 3 + kw
+    for (int oc = 0; oc < HIDDEN; oc += 1) {
+        for (int t = 0; t < TAPS; t += 1) {
+            w1[t * CH + oc] = conv1_w[oc * TAPS + t];
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                w2[(t * HIDDEN + ic) * CH + oc] =
+                    conv2_w[(oc * HIDDEN + ic) * TAPS + t];
+            }
+        }
+        b1[oc] = conv1_b[oc];
+        b2[oc] = conv2_b[oc];
+    }
+    for (int ic = 0; ic < HIDDEN; ic += 1) {
+        for (int t = 0; t < TAPS; t += 1) {
+            w3[t * CH + ic] = conv3_w[ic * TAPS + t];
+        }
+    }
+    b3 = conv3_b[0];
+
+#ifdef FAST_NET_X86
+    avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    avx2 = false;
+#endif
+}
+
+void FastNet::forward(const float* input, float* output, int batch) const {
+    for (int b = 0; b < batch; b += 1) {
+        if (avx2) {
+            forward_avx2(input + b * BOARD_CELLS,
+                         output + b * BOARD_CELLS);
+        } else {
+            forward_scalar(input + b * BOARD_CELLS,
+                           output + b * BOARD_CELLS);
+        }
+    }
+}
+
+Policy FastNet::forward(const Canonical& canonical) const {
+    Policy policy;
+    forward(&canonical[0][0], policy.data(), 1);
+    return policy;
+}
+
+void FastNet::forward_scalar(const float* input, float* output) const {
+    alignas(32) float board[CELLS] = {};
+    alignas(32) float act1[CELLS][CH] = {};
+    alignas(32) float act2[CELLS][CH] = {};
+    float logits[BOARD_CELLS];
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        board[bordered(c)] = input[c];
+    }
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        float acc[CH];
+        std::memcpy(acc, b1.data(), sizeof(acc));
+        for (int t = 0; t < TAPS; t += 1) {
+            float x = board[p + TAP_OFFSET[t]];
+            for (int oc = 0; oc < CH; oc += 1) {
+                acc[oc] += x * w1[t * CH + oc];
+            }
+        }
+        for (int oc = 0; oc < CH; oc += 1) {
+            act1[p][oc] = std::max(acc[oc], 0.0f);
+        }
+    }
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        float acc[CH];
+        std::memcpy(acc, b2.data(), sizeof(acc));
+        for (int t = 0; t < TAPS; t += 1) {
+            const float* in = act1[p + TAP_OFFSET[t]];
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                const float* w = &w2[(t * HIDDEN + ic) * CH];
+                for (int oc = 0; oc < CH; oc += 1) {
+                    acc[oc] += in[ic] * w[oc];
+                }
+            }
+        }
+        for (int oc = 0; oc < CH; oc += 1) {
+            act2[p][oc] = std::max(acc[oc], 0.0f);
+        }
+    }
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        float acc = b3;
+        for (int t = 0; t < TAPS; t += 1) {
+            const float* in = act2[p + TAP_OFFSET[t]];
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                acc += in[ic] * w3[t * CH + ic];
+            }
+        }
+        logits[c] = std::max(acc, 0.0f);
+    }
+
+    log_softmax(logits, output);
+}
+
+#ifdef FAST_NET_X86
+__attribute__((target("avx2,fma"))) void
+FastNet::forward_avx2(const float* input, float* output) const {
+    alignas(32) float board[CELLS] = {};
+    alignas(32) float act1[CELLS][CH] = {};
+    alignas(32) float act2[CELLS][CH] = {};
+    float logits[BOARD_CELLS];
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        board[bordered(c)] = input[c];
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+
+    // conv1: one input channel, broadcast each tap over the output channels
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        __m256 acc0 = _mm256_load_ps(&b1[0]);
+        __m256 acc1 = _mm256_load_ps(&b1[8]);
+        __m256 acc2 = _mm256_load_ps(&b1[16]);
+        for (int t = 0; t < TAPS; t += 1) {
+            __m256 x = _mm256_set1_ps(board[p + TAP_OFFSET[t]]);
+            const float* w = &w1[t * CH];
+            acc0 = _mm256_fmadd_ps(x, _mm256_load_ps(w), acc0);
+            acc1 = _mm256_fmadd_ps(x, _mm256_load_ps(w + 8), acc1);
+            acc2 = _mm256_fmadd_ps(x, _mm256_load_ps(w + 16), acc2);
+        }
+        _mm256_store_ps(&act1[p][0], _mm256_max_ps(acc0, zero));
+        _mm256_store_ps(&act1[p][8], _mm256_max_ps(acc1, zero));
+        _mm256_store_ps(&act1[p][16], _mm256_max_ps(acc2, zero));
+    }
+
+    // conv2: broadcast each input channel of each tap, two cells at a time
+    // so that every weight load feeds two FMAs
+    for (int c = 0; c < BOARD_CELLS; c += 2) {
+        // an odd last cell is paired with itself
+        int p = bordered(c);
+        int q = bordered(std::min(c + 1, BOARD_CELLS - 1));
+        __m256 acc0 = _mm256_load_ps(&b2[0]);
+        __m256 acc1 = _mm256_load_ps(&b2[8]);
+        __m256 acc2 = _mm256_load_ps(&b2[16]);
+        __m256 acc3 = acc0;
+        __m256 acc4 = acc1;
+        __m256 acc5 = acc2;
+        for (int t = 0; t < TAPS; t += 1) {
+            const float* in_p = act1[p + TAP_OFFSET[t]];
+            const float* in_q = act1[q + TAP_OFFSET[t]];
+            const float* w = &w2[t * HIDDEN * CH];
+            for (int ic = 0; ic < HIDDEN; ic += 1, w += CH) {
+                __m256 w0 = _mm256_load_ps(w);
+                __m256 w1 = _mm256_load_ps(w + 8);
+                __m256 w2 = _mm256_load_ps(w + 16);
+                __m256 x = _mm256_set1_ps(in_p[ic]);
+                __m256 y = _mm256_set1_ps(in_q[ic]);
+                acc0 = _mm256_fmadd_ps(x, w0, acc0);
+                acc1 = _mm256_fmadd_ps(x, w1, acc1);
+                acc2 = _mm256_fmadd_ps(x, w2, acc2);
+                acc3 = _mm256_fmadd_ps(y, w0, acc3);
+                acc4 = _mm256_fmadd_ps(y, w1, acc4);
+                acc5 = _mm256_fmadd_ps(y, w2, acc5);
+            }
+        }
+        _mm256_store_ps(&act2[p][0], _mm256_max_ps(acc0, zero));
+        _mm256_store_ps(&act2[p][8], _mm256_max_ps(acc1, zero));
+        _mm256_store_ps(&act2[p][16], _mm256_max_ps(acc2, zero));
+        _mm256_store_ps(&act2[q][0], _mm256_max_ps(acc3, zero));
+        _mm256_store_ps(&act2[q][8], _mm256_max_ps(acc4, zero));
+        _mm256_store_ps(&act2[q][16], _mm256_max_ps(acc5, zero));
+    }
+
+    // conv3: single output, so vectorize over the input channels instead
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        __m256 acc0 = zero;
+        __m256 acc1 = zero;
+        __m256 acc2 = zero;
+        for (int t = 0; t < TAPS; t += 1) {
+            const float* in = act2[p + TAP_OFFSET[t]];
+            const float* w = &w3[t * CH];
+            acc0 = _mm256_fmadd_ps(_mm256_load_ps(in), _mm256_load_ps(w), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_load_ps(in + 8),
+                                   _mm256_load_ps(w + 8), acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_load_ps(in + 16),
+                                   _mm256_load_ps(w + 16), acc2);
+        }
+        __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), acc2);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+                                 _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_movehdup_ps(half));
+        logits[c] = std::max(_mm_cvtss_f32(half) + b3, 0.0f);
+    }
+
+    log_softmax(logits, output);
+}
+#else
+void FastNet::forward_avx2(const float* input, float* output) const {
+    forward_scalar(input, output);
+}
+#endif
+
+FastNetEvaluator::FastNetEvaluator(Net net) : fast(net) {}
+
+Policy FastNetEvaluator::evaluate(const State& state) {
+    Policy policy = fast.forward(state.canonical());
+    for (float& p : policy) {
+        p = std::exp(p);
+    }
+    return policy;
+}
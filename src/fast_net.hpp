@@ -0,0 +1,54 @@
+#pragma once
+
+#include "evaluator.hpp"
+#include "model.hpp"
+#include "tensor_utils.hpp"
+
+#include <array>
+
+// Standalone CPU inference for NetImpl. The weights are packed once so that
+// every layer is a single fused pad + conv + ReLU pass over the board with a
+// zero border, vectorized over output channels. AVX2 is used when the CPU has
+// it, with a scalar fallback otherwise.
+class FastNet {
+  public:
+    // net can be on any device; the weights are copied out
+    explicit FastNet(Net net);
+
+    // log-probabilities like NetImpl::forward, for batch canonical boards of
+    // BOARD_CELLS floats each
+    void forward(const float* input, float* output, int batch) const;
+    Policy forward(const Canonical& canonical) const;
+
+    bool uses_avx2() const { return avx2; }
+
+  private:
+    // channels padded to a multiple of the vector width
+    static constexpr int CH = 24;
+    static constexpr int HIDDEN = 20;
+    static constexpr int TAPS = 9;
+
+    void forward_scalar(const float* input, float* output) const;
+    void forward_avx2(const float* input, float* output) const;
+
+    // weights as [tap][input channel][output channel]
+    alignas(32) std::array<float, TAPS * CH> w1{};
+    alignas(32) std::array<float, CH> b1{};
+    alignas(32) std::array<float, TAPS * HIDDEN * CH> w2{};
+    alignas(32) std::array<float, CH> b2{};
+    // last layer has a single output, so [tap][input channel]
+    alignas(32) std::array<float, TAPS * CH> w3{};
+    float b3 = 0.0f;
+
+    bool avx2;
+};
+
+// Evaluator running FastNet on the calling thread
+class FastNetEvaluator : public Evaluator {
+  public:
+    explicit FastNetEvaluator(Net net);
+    Policy evaluate(const State& state) override;
+
+  private:
+    FastNet fast;
+};
@@ -2,187 +2,396 @@
 
 #include <cassert>
 
+/* win lines */
+namespace {
+// A K-in-a-row window through a cell, along with the cells right before and
+// after it. A win is exactly K stones in a row, so the window has to be
+// filled while both ends stay clear of the player's stones.
+template <class Board> struct Line {
+    Board window = 0;
+    Board ends = 0;
+};
+
+template <int N, int K> struct LineTable {
+    std::array<std::array<Line<BitboardFor<N * N>>, 4 * K>, N * N> lines{};
+    std::array<int, N * N> counts{};
+};
+
+template <int N> constexpr bool on_board(int i, int j) {
+    return i >= 0 && i < N && j >= 0 && j < N;
+}
+
+template <int N> constexpr BitboardFor<N * N> bit(int i, int j) {
+    return cell_bit<BitboardFor<N * N>>(i * N + j);
+}
+
+template <int N, int K> constexpr LineTable<N, K> make_line_table() {
+    LineTable<N, K> table{};
+    constexpr int dirs[4][2] = {{1, 0}, {0, 1}, {1, 1}, {1, -1}};
+
+    for (int i = 0; i < N; i += 1) {
+        for (int j = 0; j < N; j += 1) {
+            int cell = i * N + j;
+            for (auto& dir : dirs) {
+                int di = dir[0];
+                int dj = dir[1];
+                // windows starting at (i, j) - k * (di, dj)
+                for (int k = 0; k < K; k += 1) {
+                    int si = i - k * di;
+                    int sj = j - k * dj;
+                    int ei = si + (K - 1) * di;
+                    int ej = sj + (K - 1) * dj;
+                    if (!on_board<N>(si, sj) || !on_board<N>(ei, ej)) {
+                        continue;
+                    }
+
+                    Line<BitboardFor<N * N>> line{};
+                    for (int n = 0; n < K; n += 1) {
+                        line.window |= bit<N>(si + n * di, sj + n * dj);
+                    }
+                    if (on_board<N>(si - di, sj - dj)) {
+                        line.ends |= bit<N>(si - di, sj - dj);
+                    }
+                    if (on_board<N>(ei + di, ej + dj)) {
+                        line.ends |= bit<N>(ei + di, ej + dj);
+                    }
+
+                    table.lines[cell][table.counts[cell]] = line;
+                    table.counts[cell] += 1;
+                }
+            }
+        }
+    }
+    return table;
+}
+
+template <int N, int K>
+constexpr LineTable<N, K> LINES = make_line_table<N, K>();
+
+// every window on the board once
+template <int N, int K> struct WindowTable {
+    std::array<Line<BitboardFor<N * N>>, 4 * N * N> lines{};
+    int count = 0;
+};
+
+template <int N, int K> constexpr WindowTable<N, K> make_window_table() {
+    WindowTable<N, K> table{};
+    for (int cell = 0; cell < N * N; cell += 1) {
+        for (int n = 0; n < LINES<N, K>.counts[cell]; n += 1) {
+            // listed at the first cell of the window
+            const auto& line = LINES<N, K>.lines[cell][n];
+            if (lowest_cell(line.window) == cell) {
+                table.lines[table.count] = line;
+                table.count += 1;
+            }
+        }
+    }
+    return table;
+}
+
+template <int N, int K>
+constexpr WindowTable<N, K> WINDOWS = make_window_table<N, K>();
+
+template <int N> constexpr BitboardFor<N * N> make_full_board() {
+    BitboardFor<N * N> board = 0;
+    for (int cell = 0; cell < N * N; cell += 1) {
+        board |= cell_bit<BitboardFor<N * N>>(cell);
+    }
+    return board;
+}
+
+template <int N> constexpr BitboardFor<N * N> FULL_BOARD = make_full_board<N>();
+
+/* zobrist keys */
+template <int Cells> struct ZobristTable {
+    // per player (white, black) and cell
+    std::array<std::array<uint64_t, Cells>, 2> stones{};
+    // toggled whenever the player to move changes
+    uint64_t black_to_move = 0;
+};
+
+constexpr uint64_t splitmix64(uint64_t& seed) {
+    seed += 0x9e3779b97f4a7c15ull;
+    uint64_t z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+template <int Cells> constexpr ZobristTable<Cells> make_zobrist_table() {
+    ZobristTable<Cells> table{};
+    uint64_t seed = 0x676f6d6f6b75ull;
+    for (auto& player : table.stones) {
+        for (auto& key : player) {
+            key = splitmix64(seed);
+        }
+    }
+    table.black_to_move = splitmix64(seed);
+    return table;
+}
+
+template <int Cells>
+constexpr ZobristTable<Cells> ZOBRIST = make_zobrist_table<Cells>();
+
+/* symmetries */
+template <int N>
+using SymmetryTable = std::array<std::array<int, N * N>, SYMMETRIES>;
+
+template <int N> constexpr SymmetryTable<N> make_symmetry_table() {
+    SymmetryTable<N> table{};
+    for (int s = 0; s < SYMMETRIES; s += 1) {
+        for (int cell = 0; cell < N * N; cell += 1) {
+            int i = cell / N;
+            int j = cell % N;
+            if (s & 4) {
+                int t = i;
+                i = j;
+                j = t;
+            }
+            for (int r = 0; r < (s & 3); r += 1) {
+                int t = i;
+                i = N - 1 - j;
+                j = t;
+            }
+            table[s][cell] = i * N + j;
+        }
+    }
+    return table;
+}
+
+template <int N> constexpr SymmetryTable<N> SYMMETRY = make_symmetry_table<N>();
+
+template <int N, int K> bool wins_at(BitboardFor<N * N> stones, int cell) {
+    const auto& lines = LINES<N, K>.lines[cell];
+    for (int n = 0; n < LINES<N, K>.counts[cell]; n += 1) {
+        if ((stones & lines[n].window) == lines[n].window &&
+            (stones & lines[n].ends) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+template <int N> int transform_cell(int symmetry, int cell) {
+    return SYMMETRY<N>[symmetry][cell];
+}
+
+template <int N>
+BitboardFor<N * N> transform_board(int symmetry, BitboardFor<N * N> board) {
+    BitboardFor<N * N> image = 0;
+    for (; board != 0; board &= board - 1) {
+        image |= cell_bit<BitboardFor<N * N>>(
+            SYMMETRY<N>[symmetry][lowest_cell(board)]);
+    }
+    return image;
+}
+
 /* state implementation */
 // constructors
-State::State() {}
-State::State(const State& rhs) {
-    board = rhs.board;
+template <int N, int K> BasicState<N, K>::BasicState() {}
+template <int N, int K>
+BasicState<N, K>::BasicState(const BasicState& rhs) {
+    white = rhs.white;
+    black = rhs.black;
+    hash = rhs.hash;
     next = rhs.next;
     winner = rhs.winner;
+    last_move = rhs.last_move;
     age = rhs.age;
 }
-State& State::operator=(const State& rhs) {
-    board = rhs.board;
+template <int N, int K>
+BasicState<N, K>& BasicState<N, K>::operator=(const BasicState& rhs) {
+    white = rhs.white;
+    black = rhs.black;
+    hash = rhs.hash;
     next = rhs.next;
     winner = rhs.winner;
+    last_move = rhs.last_move;
     age = rhs.age;
     return *this;
 }
 
+// comparisons
+template <int N, int K>
+bool BasicState<N, K>::operator==(const BasicState& rhs) const {
+    return hash == rhs.hash && white == rhs.white && black == rhs.black &&
+           next == rhs.next;
+}
+template <int N, int K>
+bool BasicState<N, K>::precedes(const BasicState& rhs) const {
+    return (white & ~rhs.white) == 0 && (black & ~rhs.black) == 0;
+}
+
 // getters
-bool State::is_ended() const { return (age == 36) || (winner.has_value()); }
-int State::get_age() const { return age; }
-std::optional<Player> State::get_winner() const { return winner; }
-Player State::get_next() const { return next; }
-std::array<std::array<float, 6>, 6> State::canonical() const {
-    std::array<std::array<float, 6>, 6> arr;
-    for (size_t i = 0; i < 6; i += 1) {
-        for (size_t j = 0; j < 6; j += 1) {
-            if (board[i][j] == next) {
-                arr[i][j] = 1.0f;
-            } else if (board[i][j] == !next) {
-                arr[i][j] = -1.0f;
-            } else {
-                assert(board[i][j] == Stone::None);
-                arr[i][j] = 0.0f;
-            }
+template <int N, int K> bool BasicState<N, K>::is_ended() const {
+    return (age == CELLS) || (winner.has_value());
+}
+template <int N, int K> int BasicState<N, K>::get_age() const { return age; }
+template <int N, int K>
+std::optional<Player> BasicState<N, K>::get_winner() const {
+    return winner;
+}
+template <int N, int K> Player BasicState<N, K>::get_next() const {
+    return next;
+}
+template <int N, int K> int BasicState<N, K>::get_last_move() const {
+    return last_move;
+}
+template <int N, int K>
+Stone BasicState<N, K>::get_stone(int i, int j) const {
+    int cell = i * N + j;
+    if (has_cell(white, cell)) {
+        return Stone::White;
+    } else if (has_cell(black, cell)) {
+        return Stone::Black;
+    } else {
+        return Stone::None;
+    }
+}
+template <int N, int K>
+auto BasicState<N, K>::get_stones(Player player) const -> Bitboard {
+    return (player == Player::White) ? white : black;
+}
+template <int N, int K>
+auto BasicState<N, K>::get_empty() const -> Bitboard {
+    return ~(white | black) & FULL_BOARD<N>;
+}
+template <int N, int K>
+auto BasicState<N, K>::winning_cells(Player player) const -> Bitboard {
+    Bitboard stones = get_stones(player);
+    Bitboard empty = get_empty();
+    Bitboard cells = 0;
+    // windows missing one stone on an empty cell, with clear ends
+    for (int n = 0; n < WINDOWS<N, K>.count; n += 1) {
+        const auto& line = WINDOWS<N, K>.lines[n];
+        Bitboard missing = line.window & ~stones;
+        if ((missing & (missing - 1)) == 0 && (missing & empty) != 0 &&
+            (stones & line.ends) == 0) {
+            cells |= missing;
         }
     }
+    return cells;
+}
+template <int N, int K>
+bool BasicState<N, K>::can_win(Player player) const {
+    Bitboard stones = get_stones(player);
+    Bitboard others = get_stones(!player);
+    int empty = CELLS - age;
+    int moves = (player == next) ? (empty + 1) / 2 : empty / 2;
+    for (int n = 0; n < WINDOWS<N, K>.count; n += 1) {
+        const auto& line = WINDOWS<N, K>.lines[n];
+        if ((line.window & others) == 0 && (line.ends & stones) == 0 &&
+            bit_count(line.window & ~stones) <= moves) {
+            return true;
+        }
+    }
+    return false;
+}
+template <int N, int K> uint64_t BasicState<N, K>::get_hash() const {
+    return hash;
+}
+template <int N, int K>
+std::array<std::array<float, N>, N> BasicState<N, K>::canonical() const {
+    std::array<std::array<float, N>, N> arr;
+    write_board(&arr[0][0]);
     return arr;
 }
 
+// no branches per cell, so the loops vectorize
+template <int N, int K>
+void BasicState<N, K>::write_board(float* out) const {
+    Bitboard mine = get_stones(next);
+    Bitboard theirs = get_stones(!next);
+    for (int cell = 0; cell < CELLS; cell += 1) {
+        out[cell] = static_cast<float>(has_cell(mine, cell)) -
+                    static_cast<float>(has_cell(theirs, cell));
+    }
+}
+
+template <int N, int K>
+void BasicState<N, K>::write_planes(float* out) const {
+    Bitboard mine = get_stones(next);
+    Bitboard theirs = get_stones(!next);
+    float to_move = (next == Player::Black) ? 1.0f : 0.0f;
+    for (int cell = 0; cell < CELLS; cell += 1) {
+        out[cell] = static_cast<float>(has_cell(mine, cell));
+        out[CELLS + cell] = static_cast<float>(has_cell(theirs, cell));
+        out[2 * CELLS + cell] = to_move;
+        out[3 * CELLS + cell] = (cell == last_move) ? 1.0f : 0.0f;
+    }
+}
+
 // list out actions
-std::vector<Action> State::get_actions() const {
+template <int N, int K>
+auto BasicState<N, K>::get_actions() const -> std::vector<Action> {
     std::vector<Action> actions{};
-    for (size_t i = 0; i < 6; i += 1) {
-        for (size_t j = 0; j < 6; j += 1) {
-            if (board[i][j] == Stone::None) {
-                actions.push_back(Action(i, j));
-            }
-        }
+    Bitboard empty = get_empty();
+    while (empty != 0) {
+        int cell = lowest_cell(empty);
+        empty &= empty - 1;
+        actions.push_back(Action::from_cell(cell));
     }
     return actions;
 }
 
 // perform action
-void State::place(Action action) {
-    assert(action.i < 6 && action.i >= 0);
-    assert(action.j < 6 && action.j >= 0);
-    int i = action.i;
-    int j = action.j;
+template <int N, int K> void BasicState<N, K>::place(Action action) {
+    assert(action.i < N && action.i >= 0);
+    assert(action.j < N && action.j >= 0);
+    assert(get_stone(action.i, action.j) == Stone::None);
+    int cell = action.cell();
     Player me = next;
     next = !next;
+    last_move = static_cast<int16_t>(cell);
     age += 1;
 
-    board[i][j] = stone_from_player(me);
+    Bitboard& stones = (me == Player::White) ? white : black;
+    stones |= cell_bit<Bitboard>(cell);
+    hash ^= ZOBRIST<CELLS>.stones[me == Player::Black][cell] ^
+            ZOBRIST<CELLS>.black_to_move;
 
-    /* Vertical winner check */
-    int vertical_count = 0;
-    // vertical down
-    for (int x = i + 0; x <= i + 5 && x < 6; x += 1) {
-        if (board[x][j] == me) {
-            vertical_count += 1;
-        } else {
-            break;
-        }
-    }
-    // vertical up
-    for (int x = i - 1; x >= i - 5 && x >= 0; x -= 1) {
-        if (board[x][j] == me) {
-            vertical_count += 1;
-        } else {
-            break;
-        }
-    }
-    if (vertical_count == 5) {
+    if (wins_at<N, K>(stones, cell)) {
         winner = me;
-        return;
     }
+}
 
-    /* Horizontal winner check */
-    int hori_count = 0;
-    // horizontal right
-    for (int y = j + 0; y <= j + 5 && y < 6; y += 1) {
-        if (board[i][y] == me) {
-            hori_count += 1;
-        } else {
-            break;
-        }
-    }
-    // horizontal left
-    for (int y = j - 1; y >= j - 5 && y >= 0; y -= 1) {
-        if (board[i][y] == me) {
-            hori_count += 1;
-        } else {
-            break;
-        }
-    }
-    if (hori_count == 5) {
-        winner = me;
-        return;
-    }
-
-    /* Main diagonal winner check */
-    int main_count = 0;
-    // main diag bot-right
-    {
-        int x = i;
-        int y = j;
-        while (x <= i + 5 && x < 6 && y < 6) {
-            if (board[x][y] == me) {
-                main_count += 1;
-                x += 1;
-                y += 1;
-            } else {
-                break;
-            }
-        }
-    }
-    // main diag top-left
-    {
-        int x = i - 1;
-        int y = j - 1;
-        while (x >= i - 5 && x >= 0 && y >= 0) {
-            if (board[x][y] == me) {
-                main_count += 1;
-                x -= 1;
-                y -= 1;
-            } else {
-                break;
-            }
+template <int N, int K>
+std::ostream& operator<<(std::ostream& out, const BasicState<N, K>& state) {
+    for (int i = 0; i < N; i += 1) {
+        for (int j = 0; j < N; j += 1) {
+            out << state.get_stone(i, j);
         }
+        out << '\n';
     }
-    if (main_count == 5) {
-        winner = me;
-        return;
-    }
-
-    /* Second diagonal winner check */
-    int sec_count = 0;
-    // second diag bot-left (x goes up, y goes down)
-    {
-        int x = i;
-        int y = j;
-        while (x <= i + 5 && x < 6 && y >= 0) {
-            if (board[x][y] == me) {
-                sec_count += 1;
-                x += 1;
-                y -= 1;
-            } else {
-                break;
-            }
-        }
-    }
-    // second diag top-right (x goes down, y goes up)
-    {
-        int x = i - 1;
-        int y = j + 1;
-        while (x >= i - 5 && x >= 0 && y < 6) {
-            if (board[x][y] == me) {
-                sec_count += 1;
-                x -= 1;
-                y += 1;
-            } else {
-                break;
-            }
-        }
-    }
-    if (sec_count == 5) {
-        winner = me;
-        return;
-    }
+    return out;
 }
 
+/* instantiations */
+#define INSTANTIATE_BOARD(N)                                                   \
+    template int transform_cell<N>(int symmetry, int cell);                    \
+    template BitboardFor<N * N> transform_board<N>(int symmetry,               \
+                                                   BitboardFor<N * N> board);
+#define INSTANTIATE_GAME(N, K)                                                 \
+    template class BasicState<N, K>;                                           \
+    template std::ostream& operator<<(std::ostream& out,                       \
+                                      const BasicState<N, K>& state);
+
+INSTANTIATE_BOARD(6)
+INSTANTIATE_BOARD(9)
+INSTANTIATE_BOARD(15)
+INSTANTIATE_GAME(6, 5)
+INSTANTIATE_GAME(9, 5)
+INSTANTIATE_GAME(15, 5)
+
+// any other size of the build
+#if GOMOKU_BOARD_SIZE != 6 && GOMOKU_BOARD_SIZE != 9 && GOMOKU_BOARD_SIZE != 15
+INSTANTIATE_BOARD(GOMOKU_BOARD_SIZE)
+INSTANTIATE_GAME(GOMOKU_BOARD_SIZE, GOMOKU_WIN_LENGTH)
+#elif GOMOKU_WIN_LENGTH != 5
+INSTANTIATE_GAME(GOMOKU_BOARD_SIZE, GOMOKU_WIN_LENGTH)
+#endif
+
 /* equality between stone and player */
 bool operator==(Stone stone, Player player) {
     bool white_match = (stone == Stone::White && player == Player::White);
@@ -223,18 +432,3 @@ std::ostream& operator<<(std::ostream& out, Stone stone) {
     }
     return out;
 }
-
-std::ostream& operator<<(std::ostream& out, const Action& action) {
-    out << "(" << action.i << ", " << action.j << ")";
-    return out;
-}
-
-std::ostream& operator<<(std::ostream& out, const State& state) {
-    for (int i = 0; i < 6; i += 1) {
-        for (int j = 0; j < 6; j += 1) {
-            out << state.board[i][j];
-        }
-        out << '\n';
-    }
-    return out;
-}
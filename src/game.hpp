@@ -4,8 +4,13 @@
 #include <cstdint>
 #include <optional>
 #include <ostream>
+#include <type_traits>
 #include <vector>
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 enum class Player : uint8_t { White, Black };
 enum class Stone : uint8_t { None, White, Black };
 
@@ -23,36 +28,316 @@ Stone stone_from_player(Player player);
 std::ostream& operator<<(std::ostream& out, Player player);
 std::ostream& operator<<(std::ostream& out, Stone stone);
 
-class Action {
+// Board geometry of the build, from the BOARD_SIZE and WIN_LENGTH CMake
+// options. The game itself is a template over both, see BasicState; the rest
+// of the program is compiled for this one size.
+#ifndef GOMOKU_BOARD_SIZE
+#define GOMOKU_BOARD_SIZE 6
+#endif
+#ifndef GOMOKU_WIN_LENGTH
+#define GOMOKU_WIN_LENGTH 5
+#endif
+constexpr int BOARD_SIZE = GOMOKU_BOARD_SIZE;
+constexpr int BOARD_CELLS = BOARD_SIZE * BOARD_SIZE;
+constexpr int WIN_LENGTH = GOMOKU_WIN_LENGTH;
+
+// One bit per cell for boards of more than 64 cells: cell n is bit n % 64 of
+// word n / 64. Has the operators the search uses on uint64_t boards, so code
+// like rest &= rest - 1 works on both; arithmetic is only meant for such
+// idioms.
+template <int Words> struct WideBitboard {
+    std::array<uint64_t, Words> words{};
+
+    constexpr WideBitboard() = default;
+    constexpr WideBitboard(uint64_t low) : words{} { words[0] = low; }
+
+    constexpr WideBitboard& operator&=(const WideBitboard& rhs) {
+        for (int w = 0; w < Words; w += 1) {
+            words[w] &= rhs.words[w];
+        }
+        return *this;
+    }
+    constexpr WideBitboard& operator|=(const WideBitboard& rhs) {
+        for (int w = 0; w < Words; w += 1) {
+            words[w] |= rhs.words[w];
+        }
+        return *this;
+    }
+    constexpr WideBitboard& operator^=(const WideBitboard& rhs) {
+        for (int w = 0; w < Words; w += 1) {
+            words[w] ^= rhs.words[w];
+        }
+        return *this;
+    }
+    friend constexpr WideBitboard operator&(WideBitboard lhs,
+                                            const WideBitboard& rhs) {
+        return lhs &= rhs;
+    }
+    friend constexpr WideBitboard operator|(WideBitboard lhs,
+                                            const WideBitboard& rhs) {
+        return lhs |= rhs;
+    }
+    friend constexpr WideBitboard operator^(WideBitboard lhs,
+                                            const WideBitboard& rhs) {
+        return lhs ^= rhs;
+    }
+    friend constexpr WideBitboard operator~(WideBitboard board) {
+        for (int w = 0; w < Words; w += 1) {
+            board.words[w] = ~board.words[w];
+        }
+        return board;
+    }
+    friend constexpr WideBitboard operator-(WideBitboard lhs,
+                                            const WideBitboard& rhs) {
+        uint64_t borrow = 0;
+        for (int w = 0; w < Words; w += 1) {
+            uint64_t l = lhs.words[w];
+            uint64_t r = rhs.words[w];
+            lhs.words[w] = l - r - borrow;
+            borrow = (l < r || l - r < borrow) ? 1 : 0;
+        }
+        return lhs;
+    }
+    friend constexpr WideBitboard operator-(const WideBitboard& board) {
+        return WideBitboard{} - board;
+    }
+    friend constexpr WideBitboard operator<<(const WideBitboard& board,
+                                             int shift) {
+        WideBitboard out{};
+        int whole = shift / 64;
+        int part = shift % 64;
+        for (int w = Words - 1; w >= whole; w -= 1) {
+            out.words[w] = board.words[w - whole] << part;
+            if (part != 0 && w > whole) {
+                out.words[w] |= board.words[w - whole - 1] >> (64 - part);
+            }
+        }
+        return out;
+    }
+    friend constexpr WideBitboard operator>>(const WideBitboard& board,
+                                             int shift) {
+        WideBitboard out{};
+        int whole = shift / 64;
+        int part = shift % 64;
+        for (int w = 0; w + whole < Words; w += 1) {
+            out.words[w] = board.words[w + whole] >> part;
+            if (part != 0 && w + whole + 1 < Words) {
+                out.words[w] |= board.words[w + whole + 1] << (64 - part);
+            }
+        }
+        return out;
+    }
+    friend constexpr bool operator==(const WideBitboard& lhs,
+                                     const WideBitboard& rhs) {
+        for (int w = 0; w < Words; w += 1) {
+            if (lhs.words[w] != rhs.words[w]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    friend constexpr bool operator!=(const WideBitboard& lhs,
+                                     const WideBitboard& rhs) {
+        return !(lhs == rhs);
+    }
+    // as numbers, highest word first
+    friend constexpr bool operator<(const WideBitboard& lhs,
+                                    const WideBitboard& rhs) {
+        for (int w = Words - 1; w >= 0; w -= 1) {
+            if (lhs.words[w] != rhs.words[w]) {
+                return lhs.words[w] < rhs.words[w];
+            }
+        }
+        return false;
+    }
+};
+
+// one bit per cell, indexed by i * N + j, in a single word when it fits
+template <int Cells>
+using BitboardFor = std::conditional_t<(Cells <= 64), uint64_t,
+                                       WideBitboard<(Cells + 63) / 64>>;
+
+// board with only cell set
+template <class Board> constexpr Board cell_bit(int cell) {
+    if constexpr (std::is_same_v<Board, uint64_t>) {
+        return uint64_t{1} << cell;
+    } else {
+        Board board{};
+        board.words[cell / 64] = uint64_t{1} << (cell % 64);
+        return board;
+    }
+}
+
+// cells set in board
+constexpr int bit_count(uint64_t board) { return __builtin_popcountll(board); }
+template <int Words> constexpr int bit_count(const WideBitboard<Words>& board) {
+    int count = 0;
+    for (uint64_t word : board.words) {
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+// lowest cell set in board, which must not be empty
+constexpr int lowest_cell(uint64_t board) { return __builtin_ctzll(board); }
+template <int Words>
+constexpr int lowest_cell(const WideBitboard<Words>& board) {
+    int w = 0;
+    while (board.words[w] == 0) {
+        w += 1;
+    }
+    return w * 64 + __builtin_ctzll(board.words[w]);
+}
+
+constexpr bool has_cell(uint64_t board, int cell) {
+    return (board >> cell) & 1;
+}
+template <int Words>
+constexpr bool has_cell(const WideBitboard<Words>& board, int cell) {
+    return (board.words[cell / 64] >> (cell % 64)) & 1;
+}
+
+// n-th (0-based) cell set in board
+inline int nth_cell(uint64_t board, uint32_t n) {
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(uint64_t{1} << n, board));
+#else
+    for (uint32_t k = 0; k < n; k += 1) {
+        board &= board - 1;
+    }
+    return __builtin_ctzll(board);
+#endif
+}
+template <int Words>
+int nth_cell(const WideBitboard<Words>& board, uint32_t n) {
+    int w = 0;
+    for (uint32_t count = bit_count(board.words[0]); count <= n;
+         count = bit_count(board.words[w])) {
+        n -= count;
+        w += 1;
+    }
+    return w * 64 + nth_cell(board.words[w], n);
+}
+
+// 64 bits of board for hash tables
+constexpr uint64_t fold_bits(uint64_t board) { return board; }
+template <int Words>
+constexpr uint64_t fold_bits(const WideBitboard<Words>& board) {
+    uint64_t h = 0;
+    for (uint64_t word : board.words) {
+        h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+// a cell of an N x N board
+template <int N> class BasicAction {
   public:
-    inline Action(int i, int j) : i(i), j(j) {}
+    inline BasicAction(int i, int j) : i(i), j(j) {}
     int i, j;
 
-    friend std::ostream& operator<<(std::ostream& out, const Action& action);
+    // conversion from & to the flat cell index i * N + j
+    static inline BasicAction from_cell(int cell) {
+        return BasicAction(cell / N, cell % N);
+    }
+    inline int cell() const { return i * N + j; }
 };
-std::ostream& operator<<(std::ostream& out, const Action& action);
+template <int N>
+std::ostream& operator<<(std::ostream& out, const BasicAction<N>& action) {
+    out << "(" << action.i << ", " << action.j << ")";
+    return out;
+}
+
+// the dihedral symmetries of the board: symmetry s transposes when s & 4,
+// then rotates counterclockwise s & 3 times. Returns the image of cell.
+constexpr int SYMMETRIES = 8;
+template <int N> int transform_cell(int symmetry, int cell);
+
+// image of every cell of board under symmetry, see transform_cell
+template <int N>
+BitboardFor<N * N> transform_board(int symmetry, BitboardFor<N * N> board);
+
+// Planes written by State::write_planes, CELLS floats each in cell order:
+// stones of the player to move, stones of the opponent, all ones when black
+// is to move, and the cell of the last move.
+constexpr int INPUT_PLANES = 4;
+
+// Exact-K in a row on an N x N board. The win lines, zobrist keys and
+// symmetries are tables computed at compile time for each size, and the
+// sizes are instantiated in game.cpp.
+template <int N, int K> class BasicState {
+  public:
+    static constexpr int SIZE = N;
+    static constexpr int CELLS = N * N;
+    using Bitboard = BitboardFor<CELLS>;
+    using Action = BasicAction<N>;
 
-class State {
   private:
-    std::array<std::array<Stone, 6>, 6> board{};
+    // stones of each player
+    Bitboard white = 0;
+    Bitboard black = 0;
+    // zobrist hash of the stones and the player to move
+    uint64_t hash = 0;
     Player next = Player::White;
     std::optional<Player> winner = std::nullopt;
+    // cell of the last move, -1 before the first one. Not compared by ==,
+    // so transpositions may differ in it.
+    int16_t last_move = -1;
     int age = 0;
 
   public:
-    State();
-    State(const State& rhs);
-    State& operator=(const State& rhs);
+    BasicState();
+    BasicState(const BasicState& rhs);
+    BasicState& operator=(const BasicState& rhs);
+
+    // same stones and same player to move
+    bool operator==(const BasicState& rhs) const;
+    // every stone of this state is also on rhs
+    bool precedes(const BasicState& rhs) const;
 
     bool is_ended() const;
     std::vector<Action> get_actions() const;
     void place(Action action);
 
+    Stone get_stone(int i, int j) const;
+    Bitboard get_stones(Player player) const;
+    Bitboard get_empty() const;
+    // empty cells where a stone of player would win the game
+    Bitboard winning_cells(Player player) const;
+    // whether player could still win, counting only their remaining moves
+    bool can_win(Player player) const;
+    uint64_t get_hash() const;
+
     int get_age() const;
     Player get_next() const;
     std::optional<Player> get_winner() const;
-    std::array<std::array<float, 6>, 6> canonical() const;
-
-    friend std::ostream& operator<<(std::ostream& out, const State& state);
+    int get_last_move() const;
+    std::array<std::array<float, N>, N> canonical() const;
+    // The network input is expanded from the bitboards, which place()
+    // keeps up to date, straight into out, e.g. a slot of a batch tensor.
+    // write_board writes the CELLS floats of canonical(): +1 for the player
+    // to move, -1 for the opponent. write_planes writes the
+    // INPUT_PLANES * CELLS floats described at INPUT_PLANES.
+    void write_board(float* out) const;
+    void write_planes(float* out) const;
 };
-std::ostream& operator<<(std::ostream& out, const State& state);
+template <int N, int K>
+std::ostream& operator<<(std::ostream& out, const BasicState<N, K>& state);
+
+// the common sizes, compiled once in game.cpp
+extern template class BasicState<6, 5>;
+extern template class BasicState<9, 5>;
+extern template class BasicState<15, 5>;
+
+// the game of the build
+using Bitboard = BitboardFor<BOARD_CELLS>;
+using Action = BasicAction<BOARD_SIZE>;
+using State = BasicState<BOARD_SIZE, WIN_LENGTH>;
+
+inline int transform_cell(int symmetry, int cell) {
+    return transform_cell<BOARD_SIZE>(symmetry, cell);
+}
+inline Bitboard transform_board(int symmetry, Bitboard board) {
+    return transform_board<BOARD_SIZE>(symmetry, board);
+}
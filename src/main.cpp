@@ -1,13 +1,29 @@
+#include "bounded_queue.hpp"
+#include "checkpoint.hpp"
+#include "evaluator.hpp"
+#include "fast_net.hpp"
 #include "mcts.hpp"
 #include "model.hpp"
 #include "net_query.hpp"
+#include "opening_book.hpp"
+#include "quant_net.hpp"
+#include "replay_buffer.hpp"
+#include "rng.hpp"
+#include "search_stats.hpp"
+#include "solver.hpp"
 #include "tensor_utils.hpp"
 
 #include <algorithm>
-#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <mutex>
+#include <set>
+#include <stdexcept>
 #include <random>
 #include <string>
+#include <thread>
 
 #include <torch/torch.h>
 
@@ -24,7 +40,13 @@ void create();
 void humangame();
 void netgame();
 void train();
+void loop();
 void bench();
+void threadbench();
+void fastcheck();
+void quantcheck();
+void solve();
+void book();
 void dump();
 
 int main(int argc, char** argv) {
@@ -43,8 +65,20 @@ int main(int argc, char** argv) {
         combatgame();
     } else if (subcmd == "train") {
         train();
+    } else if (subcmd == "loop") {
+        loop();
     } else if (subcmd == "bench") {
         bench();
+    } else if (subcmd == "threadbench") {
+        threadbench();
+    } else if (subcmd == "fastcheck") {
+        fastcheck();
+    } else if (subcmd == "quantcheck") {
+        quantcheck();
+    } else if (subcmd == "solve") {
+        solve();
+    } else if (subcmd == "book") {
+        book();
     } else if (subcmd == "humangame") {
         humangame();
     } else if (subcmd == "netgame") {
@@ -71,7 +105,9 @@ void create() {
     fmt::print("Creating net\n");
 
     auto net = Net();
-    auto x = torch::eye(6).reshape({1, 1, 6, 6}).repeat({2, 1, 1, 1});
+    auto x = torch::eye(BOARD_SIZE)
+                 .reshape({1, 1, BOARD_SIZE, BOARD_SIZE})
+                 .repeat({2, 1, 1, 1});
     auto policy = net->forward(x);
 
     fmt::print("input shape = {}\n"
@@ -86,14 +122,72 @@ void create() {
     torch::save(opt, "opt.pt");
 }
 
-Action randmove(State state) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+// seed of every random stream: SEED if supplied, otherwise a fresh one that
+// is printed so that the run can be repeated
+uint64_t master_seed() {
+    static uint64_t seed = [] {
+        if (const char* seed_s = std::getenv("SEED")) {
+            fmt::print("Using supplied seed {}\n", seed_s);
+            return static_cast<uint64_t>(std::strtoull(seed_s, nullptr, 10));
+        }
+        std::random_device rd;
+        uint64_t fresh = (uint64_t{rd()} << 32) | rd();
+        fmt::print("Using random seed {}\n", fresh);
+        return fresh;
+    }();
+    return seed;
+}
 
+Action randmove(State state, Rng& rng) {
     auto actions = state.get_actions();
-    std::uniform_int_distribution<> dist(0, actions.size() - 1);
-    Action action = actions[dist(gen)];
-    return action;
+    return actions[rng.below(actions.size())];
+}
+
+// SEARCH is either "ucb" (plain UCB1, the default) or "puct" (network priors)
+std::string search_mode() {
+    const char* search_s = std::getenv("SEARCH");
+    return search_s ? search_s : "ucb";
+}
+
+// network evaluator, memoized unless EVAL_CACHE is 0. EVAL_ENGINE=fast runs
+// FastNet and EVAL_ENGINE=quant runs QuantNet on the calling thread,
+// otherwise libtorch is batched across threads when EVAL_BATCH is above 1.
+std::shared_ptr<Evaluator> net_evaluator(Net net) {
+    std::shared_ptr<Evaluator> evaluator;
+    const char* engine_s = std::getenv("EVAL_ENGINE");
+    const char* batch_s = std::getenv("EVAL_BATCH");
+    int batch = batch_s ? std::atoi(batch_s) : 1;
+    if (engine_s && std::string(engine_s) == "fast") {
+        fmt::print("Using FastNet evaluation\n");
+        evaluator = std::make_shared<FastNetEvaluator>(net);
+    } else if (engine_s && std::string(engine_s) == "quant") {
+        fmt::print("Using QuantNet evaluation\n");
+        evaluator = std::make_shared<QuantNetEvaluator>(net);
+    } else if (batch > 1) {
+        const char* wait_s = std::getenv("EVAL_WAIT_US");
+        int wait = wait_s ? std::atoi(wait_s) : 200;
+        fmt::print("Using evaluation batches of {} within {} us\n", batch,
+                   wait);
+        evaluator = std::make_shared<BatchEvaluator>(
+            net, batch, std::chrono::microseconds(wait));
+    } else {
+        evaluator = std::make_shared<NetEvaluator>(net);
+    }
+
+    return cached_evaluator(evaluator);
+}
+
+// evaluator for Mcts according to SEARCH
+std::shared_ptr<Evaluator> search_evaluator(Net net) {
+    if (search_mode() == "puct") {
+        fmt::print("Using PUCT search\n");
+        return net_evaluator(net);
+    } else if (search_mode() != "ucb") {
+        fmt::print(stderr, FGRED, "unknown search {}, using ucb\n",
+                   search_mode());
+    }
+    fmt::print("Using UCB search\n");
+    return nullptr;
 }
 
 void show_winner(State state) {
@@ -105,10 +199,11 @@ void show_winner(State state) {
 }
 
 void randgame() {
+    Rng rng{master_seed()};
     State state{};
     while (state.is_ended() == false) {
         auto me = state.get_next();
-        auto action = randmove(state);
+        auto action = randmove(state, rng);
         state.place(action);
 
         fmt::print("{} placed stone at {}:\n{}\n", me, action, state);
@@ -118,7 +213,12 @@ void randgame() {
 
 void humangame() {
     State state{};
-    Mcts mcts{};
+    Net net{};
+    if (search_mode() == "puct") {
+        torch::load(net, "net.pt");
+    }
+    net->to(torch::kCPU);
+    Mcts mcts{search_evaluator(net)};
 
     while (state.is_ended() == false) {
         auto me = state.get_next();
@@ -160,8 +260,9 @@ void netgame() {
             fmt::print("{} placed stone at {}:\n{}\n", me, action, state);
         } else {
             auto options = torch::TensorOptions().dtype(torch::kFloat32);
-            net->manual_forward(torch::from_blob(state.canonical().data(),
-                                                 {1, 1, 6, 6}, options));
+            net->manual_forward(
+                torch::from_blob(state.canonical().data(),
+                                 {1, 1, BOARD_SIZE, BOARD_SIZE}, options));
             auto [action, policy] = nq.raw_query(state);
             state.place(action);
 
@@ -169,233 +270,833 @@ void netgame() {
         }
     }
     show_winner(state);
+    nq.report();
 }
 
 void combatgame() {
     State state{};
     Net net{};
     torch::load(net, "net.pt");
-    Mcts mcts{};
     net->to(torch::kCUDA);
+    auto evaluator = search_evaluator(net);
+    Mcts mcts{evaluator};
+    Rng rng{master_seed()};
+    mcts.seed(Rng::stream_seed(master_seed(), 0));
 
     while (state.is_ended() == false) {
         auto me = state.get_next();
         if (state.get_age() % 2 == 0) {
-            Action action = randmove(state);
+            Action action = randmove(state, rng);
             state.place(action);
             fmt::print("{} placed stone at {}:\n{}\n", me, action, state);
         } else {
             Action action = mcts.query(state).first;
+            export_stats(fmt::format("\"scope\": \"query\", \"move\": {}",
+                                     state.get_age()),
+                         mcts.last_stats());
             state.place(action);
             fmt::print("{} placed stone at {}:\n{}\n", me, action, state);
         }
     }
     show_winner(state);
+    export_stats("\"scope\": \"game\"", mcts.stats());
+    if (evaluator != nullptr) {
+        evaluator->report();
+    }
 }
 
-void train() {
-    // print setup info
+// self-play and training settings shared by train and loop
+struct TrainConfig {
     int plays;
+    int epochs;
+    int ending;
+    int batch;
+    std::string replay_path;
+    int window;
+    bool full_augment;
+};
+
+TrainConfig train_config() {
+    TrainConfig config;
     if (const char* plays_s = getenv("PLAYS")) {
         fmt::print("Using supplied plays {}\n", plays_s);
-        plays = std::atoi(plays_s);
+        config.plays = std::atoi(plays_s);
     } else {
         fmt::print("Using default plays 8\n");
-        plays = 8;
+        config.plays = 8;
     }
-    int epochs;
     if (const char* epochs_s = getenv("EPOCHS")) {
         fmt::print("Using supplied epochs {}\n", epochs_s);
-        epochs = std::atoi(epochs_s);
+        config.epochs = std::atoi(epochs_s);
     } else {
         fmt::print("Using default epochs 8\n");
-        epochs = 8;
+        config.epochs = 8;
     }
-    int ending;
     if (const char* ending_s = getenv("ENDING")) {
         fmt::print("Using supplied ending {}\n", ending_s);
-        ending = std::atoi(ending_s);
+        config.ending = std::atoi(ending_s);
     } else {
         fmt::print("Using default ending 5\n");
-        ending = 5;
+        config.ending = 5;
+    }
+    if (const char* batch_s = getenv("BATCH")) {
+        fmt::print("Using supplied batch {}\n", batch_s);
+        config.batch = std::max(1, std::atoi(batch_s));
+    } else {
+        fmt::print("Using default batch 64\n");
+        config.batch = 64;
     }
+    const char* replay_s = std::getenv("REPLAY");
+    config.replay_path = replay_s ? replay_s : "replay.bin";
+    fmt::print("Using replay buffer {}\n", config.replay_path);
+    if (const char* window_s = getenv("WINDOW")) {
+        fmt::print("Using supplied window {}\n", window_s);
+        config.window = std::atoi(window_s);
+    } else {
+        fmt::print("Using default window 4\n");
+        config.window = 4;
+    }
+    // symmetries are applied per batch, AUGMENT is "random" (one per
+    // sample, the default) or "full" (all of them)
+    const char* augment_s = std::getenv("AUGMENT");
+    config.full_augment = augment_s && std::string(augment_s) == "full";
+    fmt::print("Using {} symmetry augmentation\n",
+               config.full_augment ? "full" : "random");
     show_iters();
+    return config;
+}
 
-    // load net
-    Net net{};
-    fmt::print("Loading model and optimizer\n");
-    torch::load(net, "net.pt");
-    torch::optim::Adam opt(net->parameters());
-    torch::load(opt, "opt.pt");
-    net->to(torch::kCUDA);
+// a finished self-play game, its last ending positions and the counters of
+// its searches
+struct SelfplayGame {
+    State end;
+    std::vector<ReplayBuffer::Sample> samples;
+    SearchStats stats;
+};
 
-    Mcts mcts{};
-    std::vector<std::pair<Canonical, Policy>> s_p_pairs{};
+// exports the search counters of every game of a generation, then of the
+// whole generation
+void export_generation_stats(uint32_t generation,
+                             const std::vector<SelfplayGame>& games) {
+    SearchStats total{};
+    for (size_t g = 0; g < games.size(); g += 1) {
+        export_stats(fmt::format("\"scope\": \"game\", "
+                                 "\"generation\": {}, \"game\": {}",
+                                 generation, g),
+                     games[g].stats);
+        total += games[g].stats;
+    }
+    export_stats(fmt::format("\"scope\": \"generation\", "
+                             "\"generation\": {}, \"games\": {}",
+                             generation, games.size()),
+                 total);
+}
 
-    int playcount = 0;
-#pragma omp parallel for
-    for (int i = 0; i < plays; i += 1) {
-        fmt::print("Selfplay game started\n", i);
-        std::vector<std::pair<Canonical, Policy>> local_s_p_pairs{};
+// random stream of a self-play game, unique per generation and game
+uint64_t game_seed(uint32_t generation, int game) {
+    return Rng::stream_seed(master_seed(),
+                            (uint64_t{generation} << 32) | uint32_t(game));
+}
 
-        State state{};
-        while (state.is_ended() == false) {
-            std::cout.flush();
+SelfplayGame play_game(std::shared_ptr<Evaluator> evaluator, int ending,
+                       uint64_t seed) {
+    std::vector<ReplayBuffer::Sample> history{};
 
-            auto me = state.get_next();
-            auto [action, policy] = mcts.query(state);
+    // the search tree and random stream live in mcts, so every game needs
+    // its own
+    Mcts mcts{evaluator};
+    mcts.seed(seed);
+    State state{};
+    while (state.is_ended() == false) {
+        std::cout.flush();
 
-            local_s_p_pairs.emplace_back(state.canonical(), policy);
+        auto [action, policy] = mcts.query(state);
 
-            state.place(action);
+        history.emplace_back(state.canonical(), policy);
+
+        state.place(action);
+    }
+
+    SelfplayGame game{state, {}, mcts.stats()};
+    for (auto it = history.rbegin(); it != history.rend(); it++) {
+        if (it - history.rbegin() < ending) {
+            game.samples.push_back(*it);
+        } else {
+            break;
         }
+    }
+    return game;
+}
+
+// plays config.plays games and keeps the last config.ending positions of each.
+// Games are seeded by generation and index and merged in order, so with one
+// search thread the samples only depend on the seed and the evaluator.
+std::vector<ReplayBuffer::Sample>
+selfplay(std::shared_ptr<Evaluator> evaluator, const TrainConfig& config,
+         uint32_t generation) {
+    std::vector<SelfplayGame> games(config.plays);
+
+    int playcount = 0;
+#pragma omp parallel for
+    for (int i = 0; i < config.plays; i += 1) {
+        fmt::print("Selfplay game started\n", i);
+        games[i] = play_game(evaluator, config.ending,
+                             game_seed(generation, i));
 
         int nth;
 #pragma omp critical
         {
-            for (auto it = local_s_p_pairs.rbegin();
-                 it != local_s_p_pairs.rend(); it++) {
-                if (it - local_s_p_pairs.rbegin() < ending) {
-                    for (auto [aug_s, aug_p] : augment(it->first, it->second)) {
-                        s_p_pairs.push_back({aug_s, aug_p});
-                    }
-                } else {
-                    break;
-                }
-            }
             playcount += 1;
             nth = playcount;
         }
         fmt::print("Selfplay game #{} ended\n", nth);
-        show_winner(state);
+        show_winner(games[i].end);
+    }
+    if (evaluator != nullptr) {
+        evaluator->report();
     }
+    export_generation_stats(generation, games);
 
-    for (int epoch = 0; epoch < epochs; epoch += 1) {
-        // Shuffle training data
-        fmt::print("Shuffling {} history samples\n", s_p_pairs.size());
-        std::random_shuffle(s_p_pairs.begin(), s_p_pairs.end());
+    std::vector<ReplayBuffer::Sample> s_p_pairs{};
+    for (auto& game : games) {
+        s_p_pairs.insert(s_p_pairs.end(), game.samples.begin(),
+                         game.samples.end());
+    }
+    return s_p_pairs;
+}
 
-        // Train
-        fmt::print("Training on {} history samples\n", s_p_pairs.size());
-        int i = 0;
-        for (auto [s, p] : s_p_pairs) {
-            net->zero_grad();
-            auto options = torch::TensorOptions().dtype(torch::kFloat32);
-            auto state_t = torch::from_blob(s.data(), {1, 1, 6, 6}, options)
-                               .to(torch::kCUDA);
-            auto policy_t =
-                torch::from_blob(p.data(), {1, 36}, options).to(torch::kCUDA);
+// trains on the last config.window generations of replay, read through the
+// memory map, and returns the number of samples trained on. Throws once the
+// loss turns NaN, before the broken weights can be checkpointed.
+int64_t fit(Net net, torch::optim::Adam& opt, const ReplayBuffer& replay,
+            torch::Device device, const TrainConfig& config) {
+    size_t first_record = replay.window_start(config.window);
+    int64_t count = replay.size() - first_record;
 
-            // fmt::print("s/v/p = {}, {}, {}\n", state_t, value_t, policy_t);
-            auto policy_p = net->forward(state_t);
-            // fmt::print("vp/pp = {}, {}\n", value_p, policy_p);
-
-            auto ploss = -(policy_p * policy_t).sum(torch::kFloat32);
-            auto loss = ploss;
-            if (*static_cast<bool*>(
-                    (loss != loss).any().to(torch::kCPU).data_ptr())) {
-                fmt::print(FGRED, "Got nan in loss (shape = {}): {}\n",
-                           loss.sizes(), loss);
-                assert(false);
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    auto symmetries = symmetry_indices(device);
+
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+    for (int epoch = 0; epoch < config.epochs; epoch += 1) {
+        fmt::print("Training on {} history samples in batches of {}\n", count,
+                   config.batch);
+        auto start = Clock::now();
+        auto order = torch::randperm(count, torch::kLong);
+        const int64_t* order_p = order.data_ptr<int64_t>();
+
+        // loss and NaN count stay on device until the next log line
+        auto loss_sum = torch::zeros({}, options.device(device));
+        auto nan_count = torch::zeros({}, options.device(device));
+        int batches = 0;
+        for (int64_t first = 0; first < count; first += config.batch) {
+            int64_t size = std::min<int64_t>(config.batch, count - first);
+            auto states_h =
+                torch::empty({size, 1, BOARD_SIZE, BOARD_SIZE}, options);
+            auto policies_h = torch::empty({size, BOARD_CELLS}, options);
+            for (int64_t n = 0; n < size; n += 1) {
+                replay.read(first_record + order_p[first + n],
+                            states_h.data_ptr<float>() + n * BOARD_CELLS,
+                            policies_h.data_ptr<float>() + n * BOARD_CELLS);
             }
+            auto [state_t, policy_t] =
+                augment(states_h.to(device), policies_h.to(device),
+                        symmetries, config.full_augment);
+
+            net->zero_grad();
+            auto policy_p = net->forward(state_t);
+            // cross entropy per sample, averaged over the batch
+            auto loss = -(policy_p * policy_t).sum(1).mean();
 
             // calculate gradients
             loss.backward();
             // update params
             opt.step();
 
-            i += 1;
-            if (i % 10 == 0) {
-                fmt::print(FGGRN, "Trained {} iterations\n", i);
-                float ploss_s =
-                    *static_cast<float*>(ploss.to(torch::kCPU).data_ptr());
-                float loss_s =
-                    *static_cast<float*>(loss.to(torch::kCPU).data_ptr());
-                fmt::print("Loss {:.3} = {:.3}\n", loss_s, ploss_s);
+            loss_sum += loss.detach();
+            nan_count += torch::isnan(loss.detach());
+            batches += 1;
+
+            bool last = first + size == count;
+            if (batches % 100 == 0 || last) {
+                // the weights are broken, and must not be checkpointed
+                if (nan_count.item<float>() > 0) {
+                    fmt::print(FGRED, "Got nan in loss\n");
+                    throw std::runtime_error("nan in training loss");
+                }
+                fmt::print(FGGRN, "Trained {} samples\n", first + size);
+                fmt::print("Loss {:.3}\n", loss_sum.item<float>() / batches);
+                loss_sum.zero_();
+                nan_count.zero_();
+                batches = 0;
             }
         }
+        double seconds = Seconds(Clock::now() - start).count();
+        fmt::print("Epoch {}: {:.0f} samples/sec\n", epoch,
+                   count / seconds);
     }
+    return count * config.epochs * (config.full_augment ? SYMMETRIES : 1);
+}
+
+torch::Device train_device() {
+    return torch::cuda::is_available() ? torch::kCUDA : torch::kCPU;
+}
+
+void train() {
+    TrainConfig config = train_config();
+    torch::manual_seed(master_seed());
+
+    // load net
+    Net net{};
+    fmt::print("Loading model and optimizer\n");
+    torch::load(net, "net.pt");
+    torch::optim::Adam opt(net->parameters());
+    torch::load(opt, "opt.pt");
+    auto device = train_device();
+    net->to(device);
+
+    // the new samples join the replay buffer as the next generation
+    ReplayBuffer replay{config.replay_path};
+    uint32_t generation = replay.latest_generation() + 1;
+    auto s_p_pairs = selfplay(search_evaluator(net), config, generation);
+    replay.append(generation, s_p_pairs);
+    fmt::print("Replay buffer holds {} samples, generation {} added {}\n",
+               replay.size(), generation, s_p_pairs.size());
+
+    fit(net, opt, replay, device, config);
 
     fmt::print("Saving model and optimizer\n");
     torch::save(net, "net.pt");
     torch::save(opt, "opt.pt");
 }
 
+// copy of the weights of net, for inference while net keeps training
+Net copy_net(Net net, torch::Device device) {
+    Net copy{};
+    copy->to(device);
+    torch::NoGradGuard no_grad;
+    auto params = net->named_parameters();
+    for (auto& param : copy->named_parameters()) {
+        param.value().copy_(params[param.key()]);
+    }
+    return copy;
+}
+
+// games and training samples per wall clock time since start
+class Throughput {
+  public:
+    void add(int64_t new_games, int64_t new_samples) {
+        games += new_games;
+        samples += new_samples;
+    }
+    void report() const {
+        double seconds = Seconds(Clock::now() - start).count();
+        fmt::print("Throughput: {:.0f} games/hour, {:.0f} samples/sec\n",
+                   games * 3600.0 / seconds, samples / seconds);
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+    Clock::time_point start = Clock::now();
+    int64_t games = 0;
+    int64_t samples = 0;
+};
+
+// train without restarting: the model, optimizer and replay buffer stay
+// loaded, and checkpoints are written in the background. GENERATIONS limits
+// the number of generations, 0 (the default) runs forever. With PIPELINE=1,
+// SELFPLAY_WORKERS threads keep playing while the network trains, using the
+// weights of the last finished generation.
+void loop() {
+    TrainConfig config = train_config();
+    int generations;
+    if (const char* generations_s = getenv("GENERATIONS")) {
+        fmt::print("Using supplied generations {}\n", generations_s);
+        generations = std::atoi(generations_s);
+    } else {
+        fmt::print("Using default generations 0 (forever)\n");
+        generations = 0;
+    }
+    torch::manual_seed(master_seed());
+    const char* pipeline_s = std::getenv("PIPELINE");
+    bool pipeline = pipeline_s && std::atoi(pipeline_s) != 0;
+    int workers = 0;
+    if (pipeline) {
+        if (const char* workers_s = getenv("SELFPLAY_WORKERS")) {
+            fmt::print("Using supplied selfplay workers {}\n", workers_s);
+            workers = std::max(1, std::atoi(workers_s));
+        } else {
+            workers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            fmt::print("Using default selfplay workers {}\n", workers);
+        }
+    }
+
+    Net net{};
+    fmt::print("Loading model and optimizer\n");
+    torch::load(net, "net.pt");
+    torch::optim::Adam opt(net->parameters());
+    torch::load(opt, "opt.pt");
+    auto device = train_device();
+    net->to(device);
+
+    ReplayBuffer replay{config.replay_path};
+    Checkpointer checkpointer{};
+    // the replay buffer knows the last generation that was played
+    uint32_t generation = replay.latest_generation();
+    fmt::print("Continuing after generation {}\n", generation);
+
+    // weights the self-play workers search with. Evaluators may hold a copy
+    // of the weights or cached policies, so every generation gets fresh ones.
+    std::mutex published_mutex;
+    auto published = search_evaluator(copy_net(net, device));
+    auto current_evaluator = [&] {
+        std::lock_guard<std::mutex> lock(published_mutex);
+        return published;
+    };
+
+    // finished games, at most a generation ahead of training. Games are
+    // seeded in the order they start, but join whichever generation is
+    // collecting when they finish, so this mode is not reproducible.
+    BoundedQueue<SelfplayGame> games(config.plays);
+    std::atomic<int> started = 0;
+    uint32_t first_generation = generation + 1;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; w += 1) {
+        threads.emplace_back([&] {
+            while (true) {
+                uint64_t seed = game_seed(first_generation, started++);
+                if (!games.push(play_game(current_evaluator(), config.ending,
+                                          seed))) {
+                    break;
+                }
+            }
+        });
+    }
+
+    Throughput throughput{};
+    for (int n = 0; generations == 0 || n < generations; n += 1) {
+        generation += 1;
+        fmt::print(fmt::emphasis::bold, "Training generation {}\n",
+                   generation);
+
+        std::vector<ReplayBuffer::Sample> s_p_pairs;
+        if (pipeline) {
+            std::vector<SelfplayGame> finished{};
+            for (int g = 0; g < config.plays; g += 1) {
+                finished.push_back(std::move(*games.pop()));
+                const SelfplayGame& game = finished.back();
+                s_p_pairs.insert(s_p_pairs.end(), game.samples.begin(),
+                                 game.samples.end());
+                fmt::print("Selfplay game #{} ended\n", g + 1);
+                show_winner(game.end);
+            }
+            export_generation_stats(generation, finished);
+        } else {
+            s_p_pairs = selfplay(current_evaluator(), config, generation);
+        }
+        replay.append(generation, s_p_pairs);
+        fmt::print("Replay buffer holds {} samples, generation {} added {}\n",
+                   replay.size(), generation, s_p_pairs.size());
+
+        int64_t trained = fit(net, opt, replay, device, config);
+        checkpointer.save(net, opt, generation);
+
+        auto evaluator = search_evaluator(copy_net(net, device));
+        {
+            std::lock_guard<std::mutex> lock(published_mutex);
+            if (pipeline && published != nullptr) {
+                published->report();
+            }
+            published = evaluator;
+        }
+
+        throughput.add(config.plays, trained);
+        throughput.report();
+    }
+
+    games.close();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// canonical board with stones of the player to move (+1) and of the
+// opponent (-1) at the given (i, j). The bench examples are laid out on 6x6
+// and sit in the top left corner of larger boards.
+Policy example_board(const std::vector<std::pair<int, int>>& mine,
+                     const std::vector<std::pair<int, int>>& theirs) {
+    Policy board{};
+    for (auto [i, j] : mine) {
+        board[i * BOARD_SIZE + j] = 1.0f;
+    }
+    for (auto [i, j] : theirs) {
+        board[i * BOARD_SIZE + j] = -1.0f;
+    }
+    return board;
+}
+
 void bench() {
+    if (BOARD_SIZE < 6) {
+        fmt::print(FGRED, "The bench examples need at least a 6x6 board\n");
+        return;
+    }
+
     // load net
     Net net{};
     fmt::print("Loading model and optimizer\n");
     torch::load(net, "net.pt");
     net->to(torch::kCPU);
 
-    /* fmt::print(FGGRN, "Bench example 1\n");
-    {
+    auto example = [&](int n, Policy board) {
+        fmt::print(FGGRN, "Bench example {}\n", n);
         auto options = torch::TensorOptions().dtype(torch::kFloat32);
-        Policy board{
-            0, 0, 0, 0, 0,  0, //
-            1, 1, 1, 1, 0,  0, //
-            0, 0, 0, 0, -1, 0, //
-            0, 0, 0, 0, -1, 0, //
-            0, 0, 0, 0, -1, 0, //
-            0, 0, 0, 0, -1, 0,
-        };
         auto policy = net->forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options), true);
-        net->manual_forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options));
+            torch::from_blob(board.data(), {1, 1, BOARD_SIZE, BOARD_SIZE},
+                             options),
+            true);
+        net->manual_forward(torch::from_blob(
+            board.data(), {1, 1, BOARD_SIZE, BOARD_SIZE}, options));
 
         fmt::print("Situation:\n");
         show_policy(board);
 
         fmt::print("policy:\n");
         show_policy(policy_from_tensor(policy.exp()));
-    } */
+    };
 
-    fmt::print(FGGRN, "Bench example 2\n");
-    {
-        auto options = torch::TensorOptions().dtype(torch::kFloat32);
-        Policy board{
-            0,  0,  1,  0,  0, 0, //
-            -1, -1, -1, -1, 0, 0, //
-            0,  0,  0,  0,  0, 0, //
-            0,  0,  0,  0,  0, 0, //
-            0,  0,  1,  0,  0, 0, //
-            0,  0,  0,  1,  0, 0,
-        };
-        auto policy = net->forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options), true);
-        net->manual_forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options));
+    /* example(1, example_board({{1, 0}, {1, 1}, {1, 2}, {1, 3}},
+                             {{2, 4}, {3, 4}, {4, 4}, {5, 4}})); */
+    example(2, example_board({{0, 2}, {4, 2}, {5, 3}},
+                             {{1, 0}, {1, 1}, {1, 2}, {1, 3}}));
+    /* example(3, example_board({{0, 2}, {0, 3}, {0, 4}},
+                             {{1, 1}, {2, 1}, {3, 1}})); */
+}
 
-        fmt::print("Situation:\n");
-        show_policy(board);
+void threadbench() {
+    show_iters();
+    for (int threads = 1; threads <= default_threads(); threads += 1) {
+        // fresh search for every thread count, running every iteration
+        Mcts mcts{threads};
+        mcts.set_book(nullptr);
+        mcts.set_early_stop(false);
+        mcts.set_move_time(0);
+        State state{};
 
-        fmt::print("policy:\n");
-        show_policy(policy_from_tensor(policy.exp()));
+        auto start = std::chrono::steady_clock::now();
+        mcts.query(state);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        fmt::print("{} threads: {:.0f} playouts/sec\n", threads,
+                   default_iters() / elapsed.count());
     }
+}
 
-    /* fmt::print(FGGRN, "Bench example 3\n");
-    {
-        auto options = torch::TensorOptions().dtype(torch::kFloat32);
-        Policy board{
-            0, 0,  1, 1, 1, 0, //
-            0, -1, 0, 0, 0, 0, //
-            0, -1, 0, 0, 0, 0, //
-            0, -1, 0, 0, 0, 0, //
-            0, 0,  0, 0, 0, 0, //
-            0, 0,  0, 0, 0, 0,
-        };
-        auto policy = net->forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options), true);
-        net->manual_forward(
-            torch::from_blob(board.data(), {1, 1, 6, 6}, options));
+// positions from random games, as canonical boards
+std::vector<Canonical> random_positions(int count) {
+    Rng rng{master_seed()};
+    std::vector<Canonical> positions{};
+    while (static_cast<int>(positions.size()) < count) {
+        State state{};
+        while (state.is_ended() == false &&
+               static_cast<int>(positions.size()) < count) {
+            positions.push_back(state.canonical());
+            state.place(randmove(state, rng));
+        }
+    }
+    return positions;
+}
 
-        fmt::print("Situation:\n");
-        show_policy(board);
+void fastcheck() {
+    int count;
+    if (const char* positions_s = getenv("POSITIONS")) {
+        fmt::print("Using supplied positions {}\n", positions_s);
+        count = std::atoi(positions_s);
+    } else {
+        fmt::print("Using default positions 1000\n");
+        count = 1000;
+    }
 
-        fmt::print("policy:\n");
-        show_policy(policy_from_tensor(policy.exp()));
-    } */
+    Net net{};
+    torch::load(net, "net.pt");
+    net->to(torch::kCPU);
+    torch::NoGradGuard no_grad;
+
+    FastNet fast{net};
+    fmt::print("FastNet kernel: {}\n", fast.uses_avx2() ? "avx2" : "scalar");
+
+    auto positions = random_positions(count);
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    auto input = torch::from_blob(positions.data(),
+                                  {count, 1, BOARD_SIZE, BOARD_SIZE}, options);
+
+    // accuracy against libtorch
+    auto expected_t = net->forward(input).contiguous();
+    const float* expected = expected_t.data_ptr<float>();
+    std::vector<float> actual(count * BOARD_CELLS);
+    fast.forward(&positions[0][0][0], actual.data(), count);
+
+    float max_diff = 0.0f;
+    int argmax_agree = 0;
+    for (int b = 0; b < count; b += 1) {
+        const float* e = expected + b * BOARD_CELLS;
+        const float* a = actual.data() + b * BOARD_CELLS;
+        for (int c = 0; c < BOARD_CELLS; c += 1) {
+            max_diff = std::max(max_diff, std::abs(e[c] - a[c]));
+        }
+        auto e_best = std::max_element(e, e + BOARD_CELLS) - e;
+        auto a_best = std::max_element(a, a + BOARD_CELLS) - a;
+        argmax_agree += (e_best == a_best) ? 1 : 0;
+    }
+    fmt::print("max |forward - fast| = {:.3e}, argmax agreement {}/{}\n",
+               max_diff, argmax_agree, count);
+    if (max_diff > 1e-4f) {
+        fmt::print(FGRED, "FastNet differs from forward\n");
+    }
+
+    // latency
+    using Clock = std::chrono::steady_clock;
+    using Micros = std::chrono::duration<double, std::micro>;
+    auto start = Clock::now();
+    for (int b = 0; b < count; b += 1) {
+        net->forward(input.narrow(0, b, 1));
+    }
+    double torch_us = Micros(Clock::now() - start).count() / count;
+
+    start = Clock::now();
+    for (int b = 0; b < count; b += 1) {
+        fast.forward(positions[b]);
+    }
+    double fast_us = Micros(Clock::now() - start).count() / count;
+
+    start = Clock::now();
+    fast.forward(&positions[0][0][0], actual.data(), count);
+    double batch_us = Micros(Clock::now() - start).count() / count;
+
+    fmt::print("libtorch batch 1: {:.2f} us/position\n", torch_us);
+    fmt::print("FastNet batch 1: {:.2f} us/position\n", fast_us);
+    fmt::print("FastNet batch {}: {:.2f} us/position\n", count, batch_us);
+}
+
+void quantcheck() {
+    int count;
+    if (const char* positions_s = getenv("POSITIONS")) {
+        fmt::print("Using supplied positions {}\n", positions_s);
+        count = std::atoi(positions_s);
+    } else {
+        fmt::print("Using default positions 1000\n");
+        count = 1000;
+    }
+
+    Net net{};
+    torch::load(net, "net.pt");
+    net->to(torch::kCPU);
+    torch::NoGradGuard no_grad;
+
+    QuantNet quant{net};
+    FastNet fast{net};
+    fmt::print("QuantNet kernel: {}\n", quant.uses_avx2() ? "avx2" : "scalar");
+
+    auto positions = random_positions(count);
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    auto input = torch::from_blob(positions.data(),
+                                  {count, 1, BOARD_SIZE, BOARD_SIZE}, options);
+
+    // the vector kernel has to match the scalar model bit for bit
+    int exact = 0;
+    for (int b = 0; b < count; b += 1) {
+        int16_t vectorized[BOARD_CELLS];
+        int16_t reference[BOARD_CELLS];
+        quant.logits(&positions[b][0][0], vectorized, true);
+        quant.logits(&positions[b][0][0], reference, false);
+        bool same = std::equal(vectorized, vectorized + BOARD_CELLS, reference);
+        exact += same ? 1 : 0;
+    }
+    fmt::print("bit-exact against scalar model: {}/{}\n", exact, count);
+    if (exact != count) {
+        fmt::print(FGRED, "QuantNet kernels disagree\n");
+    }
+
+    // accuracy loss against libtorch, as KL(forward || quant)
+    auto expected_t = net->forward(input).contiguous();
+    const float* expected = expected_t.data_ptr<float>();
+    std::vector<float> actual(count * BOARD_CELLS);
+    quant.forward(&positions[0][0][0], actual.data(), count);
+
+    float max_diff = 0.0f;
+    double total_kl = 0.0;
+    double max_kl = 0.0;
+    int argmax_agree = 0;
+    for (int b = 0; b < count; b += 1) {
+        const float* e = expected + b * BOARD_CELLS;
+        const float* a = actual.data() + b * BOARD_CELLS;
+        double kl = 0.0;
+        for (int c = 0; c < BOARD_CELLS; c += 1) {
+            max_diff = std::max(max_diff, std::abs(e[c] - a[c]));
+            kl += std::exp(e[c]) * (e[c] - a[c]);
+        }
+        total_kl += kl;
+        max_kl = std::max(max_kl, kl);
+        auto e_best = std::max_element(e, e + BOARD_CELLS) - e;
+        auto a_best = std::max_element(a, a + BOARD_CELLS) - a;
+        argmax_agree += (e_best == a_best) ? 1 : 0;
+    }
+    fmt::print("argmax agreement {}/{}, max |forward - quant| = {:.3e}\n",
+               argmax_agree, count, max_diff);
+    fmt::print("KL divergence mean {:.3e}, max {:.3e}\n", total_kl / count,
+               max_kl);
+
+    // latency
+    using Clock = std::chrono::steady_clock;
+    using Micros = std::chrono::duration<double, std::micro>;
+    auto start = Clock::now();
+    fast.forward(&positions[0][0][0], actual.data(), count);
+    double fast_us = Micros(Clock::now() - start).count() / count;
+
+    start = Clock::now();
+    quant.forward(&positions[0][0][0], actual.data(), count);
+    double quant_us = Micros(Clock::now() - start).count() / count;
+
+    fmt::print("FastNet: {:.2f} us/position\n", fast_us);
+    fmt::print("QuantNet: {:.2f} us/position\n", quant_us);
+}
+
+// solves positions of random games with SOLVE_EMPTY empty cells left,
+// within SOLVE_NODES nodes each
+void solve() {
+    int count;
+    if (const char* positions_s = getenv("POSITIONS")) {
+        fmt::print("Using supplied positions {}\n", positions_s);
+        count = std::atoi(positions_s);
+    } else {
+        fmt::print("Using default positions 100\n");
+        count = 100;
+    }
+    show_iters();
+    int empty = default_solve_empty();
+    uint64_t max_nodes = default_solve_nodes();
+
+    // games ending before reaching empty are skipped
+    Rng rng{master_seed()};
+    std::vector<State> positions{};
+    while (static_cast<int>(positions.size()) < count) {
+        State state{};
+        while (state.is_ended() == false &&
+               bit_count(state.get_empty()) > empty) {
+            state.place(randmove(state, rng));
+        }
+        if (state.is_ended() == false) {
+            positions.push_back(state);
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+    Solver solver{size_t{1} << 20};
+    int outcomes[3] = {0, 0, 0};
+    int unsolved = 0;
+    uint64_t nodes = 0;
+    auto start = Clock::now();
+    for (const State& state : positions) {
+        auto result = solver.solve(state, max_nodes);
+        nodes += solver.last_nodes();
+        if (!result.has_value()) {
+            unsolved += 1;
+            fmt::print("{}unsolved within {} nodes\n", state, max_nodes);
+            continue;
+        }
+        outcomes[result->value + 1] += 1;
+        const char* names[3] = {"loss", "draw", "win"};
+        fmt::print("{}{} to move: {} by {}, {} nodes\n", state,
+                   state.get_next(), names[result->value + 1],
+                   Action::from_cell(result->cell), result->nodes);
+    }
+    double seconds = Seconds(Clock::now() - start).count();
+
+    fmt::print("Solved {}/{}: {} wins, {} draws, {} losses\n",
+               count - unsolved, count, outcomes[2], outcomes[1],
+               outcomes[0]);
+    fmt::print("{} nodes in {:.3f} s, {:.0f} nodes/sec\n", nodes, seconds,
+               nodes / seconds);
+}
+
+// searches every position up to BOOK_PLY stones, one per symmetry class,
+// with BOOK_ITERS iterations and writes them to default_book_path()
+void book() {
+    int ply;
+    if (const char* ply_s = getenv("BOOK_PLY")) {
+        fmt::print("Using supplied book ply {}\n", ply_s);
+        ply = std::atoi(ply_s);
+    } else {
+        fmt::print("Using default book ply 2\n");
+        ply = 2;
+    }
+    int iters;
+    if (const char* iters_s = getenv("BOOK_ITERS")) {
+        fmt::print("Using supplied book iters {}\n", iters_s);
+        iters = std::atoi(iters_s);
+    } else {
+        fmt::print("Using default book iters 100000\n");
+        iters = 100000;
+    }
+    std::string path = default_book_path();
+    fmt::print("Using book {}\n", path);
+
+    // positions by number of stones, symmetric ones only once
+    using Key = std::pair<Bitboard, Bitboard>;
+    auto key_of = [](const State& state) {
+        int symmetry = canonical_symmetry(state);
+        Player me = state.get_next();
+        return Key{transform_board(symmetry, state.get_stones(me)),
+                   transform_board(symmetry, state.get_stones(!me))};
+    };
+    std::vector<State> positions{State{}};
+    std::vector<State> layer{State{}};
+    for (int stones = 1; stones <= ply; stones += 1) {
+        std::set<Key> seen{};
+        std::vector<State> next{};
+        for (const State& state : layer) {
+            for (Action action : state.get_actions()) {
+                State child{state};
+                child.place(action);
+                if (!child.is_ended() && seen.insert(key_of(child)).second) {
+                    next.push_back(child);
+                }
+            }
+        }
+        positions.insert(positions.end(), next.begin(), next.end());
+        layer = std::move(next);
+    }
+    fmt::print("Searching {} positions\n", positions.size());
+
+    Net net{};
+    if (search_mode() == "puct") {
+        torch::load(net, "net.pt");
+    }
+    net->to(torch::kCPU);
+    auto evaluator = search_evaluator(net);
+
+    // a fresh tree per position, and no book to answer from
+    std::vector<std::pair<int, OpeningBook::Policy>> moves(positions.size());
+    int count = static_cast<int>(positions.size());
+#pragma omp parallel for
+    for (int i = 0; i < count; i += 1) {
+        Mcts mcts{evaluator};
+        mcts.set_book(nullptr);
+        mcts.set_iters(iters);
+        mcts.seed(Rng::stream_seed(master_seed(), i));
+        auto policy = mcts.query(positions[i]).second;
+        int cell = static_cast<int>(
+            std::max_element(policy.begin(), policy.end()) - policy.begin());
+        moves[i] = {cell, policy};
+    }
+    if (evaluator != nullptr) {
+        evaluator->report();
+    }
+
+    OpeningBook::write(path, positions, moves);
+    fmt::print("Wrote {} positions to {}\n", positions.size(), path);
 }
 
 void dump() {
@@ -1,13 +1,18 @@
 #include "mcts.hpp"
+#include "rng.hpp"
 #include "tensor_utils.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <new>
 #include <random>
+#include <thread>
+#include <type_traits>
 
 #include <numeric>
 #include <torch/torch.h>
@@ -17,75 +22,310 @@
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
-const auto FGRED = fmt::fg(fmt::color::red);
+#include <sys/stat.h>
+#include <unistd.h>
 
-Node::Node(State state, std::optional<Action> last_action,
-           std::shared_ptr<Node> parent = nullptr)
-    : state(state), last_action(last_action), parent(parent),
-      depth((parent != nullptr) ? (parent->depth + 1) : 0) {}
+const auto FGRED = fmt::fg(fmt::color::red);
 
-Mcts::Mcts() {}
+namespace {
+using Clock = std::chrono::steady_clock;
 
-static const char* ITERS_S = std::getenv("ITERS");
-static int ITERS = ITERS_S ? std::atoi(ITERS_S) : 5000;
+int64_t nanos_since(Clock::time_point& since) {
+    auto now = Clock::now();
+    int64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - since)
+            .count();
+    since = now;
+    return ns;
+}
 
-std::pair<Action, std::array<float, 36>> Mcts::query(State state) {
-    NodePtr root = std::make_shared<Node>(state, std::nullopt);
-    Player me = state.get_next();
+void atomic_add(std::atomic<float>& target, float value) {
+    float current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value,
+                                         std::memory_order_relaxed)) {
+    }
+}
+} // namespace
+
+Node::Node(State state) : state(state) {
+    if (state.get_winner().has_value()) {
+        // the previous move won
+        proof = Loss;
+    } else if (state.is_ended()) {
+        proof = Draw;
+    }
+}
 
-    for (int iter = 0; iter < ITERS; iter += 1) {
-        NodePtr current = root;
+Node::Node(const Node& rhs)
+    : state(rhs.state), visits(rhs.visits.load()),
+      ttlvalue(rhs.ttlvalue.load()), first_edge(rhs.first_edge),
+      vloss(rhs.vloss.load()), num_children(rhs.num_children),
+      status(rhs.status.load()), proof(rhs.proof.load()),
+      unsolved(rhs.unsolved.load()) {}
+
+Edge::Edge(NodeIdx child, uint8_t cell, float prior)
+    : child(child), prior(prior), cell(cell) {}
+Edge::Edge(const Edge& rhs)
+    : child(rhs.child.load()), prior(rhs.prior), cell(rhs.cell) {}
+
+/* transposition table */
+namespace {
+constexpr uint64_t entry(uint64_t epoch, NodeIdx idx) {
+    return (epoch << 32) | idx;
+}
+} // namespace
 
-        // select
-        while (current->children.empty() == false) {
-            NodePtr selected = max_select(current);
-            current = selected;
-        }
+void NodeTable::reset(NodeIdx capacity) {
+    // keep the load factor at or below one half
+    size_t size = 1;
+    while (size < 2 * static_cast<size_t>(capacity)) {
+        size *= 2;
+    }
 
-        // expand
-        if (current->state.is_ended() == false) {
-            expand(current);
+    if (size > mask + 1 || slots == nullptr) {
+        slots.reset(new std::atomic<uint64_t>[size]);
+        for (size_t i = 0; i < size; i += 1) {
+            slots[i].store(0, std::memory_order_relaxed);
         }
+        mask = size - 1;
+        epoch = 0;
+    }
+    // entries of older epochs count as empty
+    epoch += 1;
+}
 
-        // simulate
-        float score_update;
-        auto [depth, winner] = simulate(current);
+NodeIdx NodeTable::find(const State& state, const NodeArena& nodes) const {
+    if (slots == nullptr) {
+        return NO_NODE;
+    }
 
-        // backprop
-        while (true) {
-            score_update = 1.0f - score_update;
+    for (size_t slot = state.get_hash() & mask;; slot = (slot + 1) & mask) {
+        uint64_t value = slots[slot].load(std::memory_order_acquire);
+        if ((value >> 32) != epoch) {
+            return NO_NODE;
+        }
+        NodeIdx idx = static_cast<NodeIdx>(value);
+        if (nodes[idx].state == state) {
+            return idx;
+        }
+    }
+}
 
-            current->visits += 1;
-            if (winner.has_value()) {
-                if (current->state.get_next() == winner.value()) {
-                    // this leads to a win => the parent node don't want this
-                    current->ttlvalue +=
-                        -std::exp(-0.5f * (0.2f * depth - 5.0f)) - 5.0f;
-                } else {
-                    // this leads to a lose => the parent node is happy
-                    current->ttlvalue += 1.0f;
+NodeIdx NodeTable::find_or_insert(const State& state, NodeArena& nodes) {
+    NodeIdx created = NO_NODE;
+    for (size_t slot = state.get_hash() & mask;; slot = (slot + 1) & mask) {
+        uint64_t value = slots[slot].load(std::memory_order_acquire);
+        while ((value >> 32) != epoch) {
+            // empty slot, so state is missing until now
+            if (created == NO_NODE) {
+                created = nodes.alloc(1);
+                if (created == NO_NODE) {
+                    return NO_NODE;
                 }
-            } else {
-                current->ttlvalue += 0.2;
+                new (&nodes[created]) Node(state);
             }
+            if (slots[slot].compare_exchange_weak(
+                    value, entry(epoch, created), std::memory_order_release,
+                    std::memory_order_acquire)) {
+                return created;
+            }
+        }
 
-            if (current->parent.lock() != nullptr) {
-                current = current->parent.lock();
-            } else {
-                break;
+        // lost a race for the slot, or it's taken by another position
+        NodeIdx idx = static_cast<NodeIdx>(value);
+        if (nodes[idx].state == state) {
+            // a node created here is left unused in the arena
+            return idx;
+        }
+    }
+}
+
+void swap(NodeTable& lhs, NodeTable& rhs) {
+    std::swap(lhs.slots, rhs.slots);
+    std::swap(lhs.mask, rhs.mask);
+    std::swap(lhs.epoch, rhs.epoch);
+}
+
+/* tree */
+void Tree::reset(NodeIdx node_capacity, NodeIdx edge_capacity) {
+    nodes.reset(node_capacity);
+    edges.reset(edge_capacity);
+    table.reset(node_capacity);
+}
+
+void swap(Tree& lhs, Tree& rhs) {
+    swap(lhs.nodes, rhs.nodes);
+    swap(lhs.edges, rhs.edges);
+    swap(lhs.table, rhs.table);
+}
+
+static const char* ITERS_S = std::getenv("ITERS");
+static int ITERS = ITERS_S ? std::atoi(ITERS_S) : 5000;
+static const char* REUSE_S = std::getenv("REUSE");
+static bool REUSE = REUSE_S ? (std::atoi(REUSE_S) != 0) : true;
+static const char* THREADS_S = std::getenv("THREADS");
+static int THREADS = THREADS_S ? std::max(1, std::atoi(THREADS_S)) : 1;
+static const char* CPUCT_S = std::getenv("CPUCT");
+static float CPUCT = CPUCT_S ? std::atof(CPUCT_S) : 2.0f;
+static const char* MOVE_MS_S = std::getenv("MOVE_MS");
+static int MOVE_MS = MOVE_MS_S ? std::max(0, std::atoi(MOVE_MS_S)) : 0;
+// off by default: the move is sampled from the visit counts, which are also
+// the policy target, and stopping early changes both
+static const char* EARLY_STOP_S = std::getenv("EARLY_STOP");
+static bool EARLY_STOP = EARLY_STOP_S ? (std::atoi(EARLY_STOP_S) != 0) : false;
+static const char* SOLVE_EMPTY_S = std::getenv("SOLVE_EMPTY");
+static int SOLVE_EMPTY = SOLVE_EMPTY_S ? std::atoi(SOLVE_EMPTY_S) : 10;
+static const char* BOOK_S = std::getenv("BOOK");
+static const char* SOLVE_NODES_S = std::getenv("SOLVE_NODES");
+static uint64_t SOLVE_NODES =
+    SOLVE_NODES_S ? std::strtoull(SOLVE_NODES_S, nullptr, 10) : 20000;
+
+// value taken off a node for every search currently passing through it
+constexpr float VIRTUAL_LOSS = 1.0f;
+// iterations of a worker between checks of the early stop visit counts. The
+// time limit is checked every iteration, as one may wait on the network.
+constexpr int STOP_CHECK_INTERVAL = 32;
+
+Mcts::Mcts() : Mcts(THREADS) {}
+Mcts::Mcts(int threads, std::shared_ptr<Evaluator> evaluator)
+    : threads(std::max(1, threads)), iters(ITERS), move_ms(MOVE_MS),
+      early_stop(EARLY_STOP), book(default_book()),
+      evaluator(std::move(evaluator)), rng(std::random_device{}()) {
+    if (SOLVE_EMPTY > 0) {
+        solvers.resize(this->threads);
+    }
+}
+Mcts::Mcts(std::shared_ptr<Evaluator> evaluator)
+    : Mcts(THREADS, std::move(evaluator)) {}
+
+void Mcts::seed(uint64_t seed) { rng.reseed(seed); }
+void Mcts::set_iters(int new_iters) { iters = std::max(1, new_iters); }
+void Mcts::set_move_time(int new_move_ms) {
+    move_ms = std::max(0, new_move_ms);
+}
+void Mcts::set_early_stop(bool new_early_stop) {
+    early_stop = new_early_stop;
+}
+void Mcts::set_book(std::shared_ptr<const OpeningBook> new_book) {
+    book = std::move(new_book);
+}
+
+std::pair<Action, Policy> Mcts::query(State state) {
+    auto start = Clock::now();
+    query_start = start;
+
+    // moves decided without a search
+    auto decided = [&](int cell, const Policy& policy, bool solved,
+                       bool booked) {
+        if constexpr (SEARCH_STATS) {
+            query_stats = SearchStats{};
+            query_stats.queries = 1;
+            query_stats.solved = solved ? 1 : 0;
+            query_stats.book_hits = booked ? 1 : 0;
+            total_stats += query_stats;
+        }
+        return std::make_pair(Action::from_cell(cell), policy);
+    };
+    auto one_hot = [](int cell) {
+        Policy policy{};
+        policy[cell] = 1.0f;
+        return policy;
+    };
+    Bitboard empty = state.get_empty();
+    if (bit_count(empty) == 1) {
+        int cell = lowest_cell(empty);
+        return decided(cell, one_hot(cell), false, false);
+    }
+    // book moves are sampled from the searched policy, like searched ones
+    if (book != nullptr) {
+        if (auto hit = book->find(state)) {
+            auto& [cell, policy] = *hit;
+            float sum = std::accumulate(policy.begin(), policy.end(), 0.0f);
+            if (sum > 0.0f) {
+                std::discrete_distribution<> dist(policy.begin(),
+                                                  policy.end());
+                cell = dist(rng);
             }
+            return decided(cell, policy, false, true);
+        }
+    }
+    // close to the end the solver finds a winning or drawing move on its
+    // own, lost positions are still searched to spread the policy over the
+    // moves that take longest to refute
+    if (!solvers.empty() && bit_count(empty) <= SOLVE_EMPTY) {
+        auto result = solvers[0].solve(state, SOLVE_NODES);
+        if (result.has_value() && result->value != Solver::LOSS) {
+            int cell = result->cell;
+            return decided(cell, one_hot(cell), true, false);
         }
-    } // end loop
+    }
 
-    // calculuate policy
-    std::array<float, 36> policy{};
-    for (auto child : root->children) {
-        assert(child->last_action.has_value());
-        int i = child->last_action.value().i;
-        int j = child->last_action.value().j;
+    // every iteration creates at most one node and expands at most one
+    NodeIdx node_budget = static_cast<NodeIdx>(iters);
+    NodeIdx edge_budget = static_cast<NodeIdx>(iters) * BOARD_CELLS;
+    NodeIdx reused = NO_NODE;
+    if (REUSE && root != NO_NODE) {
+        // every node in the table is reachable from the old root
+        reused = tree.table.find(state, tree.nodes);
+    }
+    if (reused != NO_NODE) {
+        promote(reused, node_budget, edge_budget);
+    } else {
+        tree.reset(1 + node_budget, edge_budget);
+        root = tree.table.find_or_insert(state, tree.nodes);
+    }
 
-        float visits = static_cast<float>(child->visits);
-        policy[i * 6 + j] = visits;
+    NodeIdx nodes_before = tree.nodes.size();
+    std::atomic<int> remaining = settled() ? 0 : iters;
+    std::vector<std::thread> workers{};
+    std::vector<Rng> worker_rngs{};
+    std::vector<SearchStats> worker_stats(threads);
+    for (int t = 1; t < threads; t += 1) {
+        worker_rngs.emplace_back(rng());
+    }
+    auto solver = [&](int t) {
+        return solvers.empty() ? nullptr : &solvers[t];
+    };
+    for (int t = 1; t < threads; t += 1) {
+        workers.emplace_back([&, t] {
+            search(remaining, worker_rngs[t - 1], worker_stats[t], solver(t));
+        });
+    }
+    search(remaining, rng, worker_stats[0], solver(0));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if constexpr (SEARCH_STATS) {
+        query_stats = SearchStats{};
+        for (const SearchStats& stats : worker_stats) {
+            query_stats += stats;
+        }
+        query_stats.queries = 1;
+        query_stats.query_ns = nanos_since(start);
+        query_stats.nodes = tree.nodes.size() - nodes_before;
+        total_stats += query_stats;
+    }
+
+    // a won or drawn root is played out exactly. A root lost in every line
+    // keeps the visits it had when the last move was refuted.
+    if (const Edge* edge = proven_select(root)) {
+        Policy policy{};
+        policy[edge->cell] = 1.0f;
+        return {Action::from_cell(edge->cell), policy};
+    }
+
+    // calculuate policy
+    Policy policy{};
+    const Node& root_node = tree.nodes[root];
+    for (NodeIdx e = 0; e < root_node.num_children; e += 1) {
+        const Edge& edge = tree.edges[root_node.first_edge + e];
+
+        NodeIdx child = edge.child;
+        if (child != NO_NODE) {
+            float visits = static_cast<float>(tree.nodes[child].visits);
+            policy[edge.cell] = visits;
+        }
     }
 
     // make it sum up to 1
@@ -100,82 +340,469 @@ std::pair<Action, std::array<float, 36>> Mcts::query(State state) {
         }
     }
 
-    auto max_child = sample_select(root);
-    return {max_child->last_action.value(), policy};
+    const Edge& max_edge = sample_select(root);
+    return {Action::from_cell(max_edge.cell), policy};
 }
 
-std::vector<float> Mcts::children_scores(NodePtr current) {
-    std::vector<float> scores(current->children.size(), 0.0f);
-    float parent_visits = static_cast<float>(current->visits);
+void Mcts::search(std::atomic<int>& remaining, Rng& rng, SearchStats& stats,
+                  Solver* solver) {
+    // nodes visited by the current iteration
+    std::array<NodeIdx, BOARD_CELLS + 1> path;
+    // start of the current phase, only read with SEARCH_STATS
+    Clock::time_point phase{};
+    int until_check = STOP_CHECK_INTERVAL;
+
+    while (remaining.fetch_sub(1, std::memory_order_relaxed) > 0) {
+        if constexpr (SEARCH_STATS) {
+            phase = Clock::now();
+        }
+        NodeIdx current = root;
+        size_t length = 0;
+        path[length++] = current;
+        tree.nodes[current].vloss += 1;
+
+        // select, down to a leaf or a proven node
+        while (tree.nodes[current].status.load(std::memory_order_acquire) ==
+                   Node::Expanded &&
+               tree.nodes[current].num_children != 0 &&
+               (current == root ||
+                tree.nodes[current].proof.load(std::memory_order_relaxed) ==
+                    Node::Unproven)) {
+            NodeIdx child = child_of(current, max_select(current));
+            if (child == NO_NODE) {
+                break;
+            }
+            current = child;
+            path[length++] = current;
+            tree.nodes[current].vloss += 1;
+        }
 
-    for (size_t i = 0; i < current->children.size(); i += 1) {
-        NodePtr child = current->children[i];
-        assert(child->last_action.has_value());
-        Action act = child->last_action.value();
+        if constexpr (SEARCH_STATS) {
+            stats.select_ns += nanos_since(phase);
+        }
 
-        float child_visits = static_cast<float>(child->visits);
+        // prove leaves close to the end, the root was tried by query().
+        // Leaves the solver gave up on are left to their children.
+        Node& leaf = tree.nodes[current];
+        if (solver != nullptr && current != root &&
+            leaf.proof.load(std::memory_order_relaxed) == Node::Unproven &&
+            !leaf.unsolved.load(std::memory_order_relaxed) &&
+            bit_count(leaf.state.get_empty()) <= SOLVE_EMPTY) {
+            solve_leaf(current, *solver, stats);
+        }
 
-        float exploit = child->ttlvalue / (child_visits + 1.0f);
-        float explore =
-            std::sqrt(2.0f * std::log(std::max(1.0f, parent_visits)) /
-                      (child_visits + 1.0f));
+        // expand, unless proven or another worker is already on it. A
+        // proven root is still searched for the move that proves it.
+        auto status = Node::Leaf;
+        if ((current == root ||
+             leaf.proof.load(std::memory_order_relaxed) == Node::Unproven) &&
+            leaf.status.compare_exchange_strong(status, Node::Expanding)) {
+            // without room for its edges it stays a leaf, to be expanded by
+            // a later query with a fresh arena
+            bool expanded = expand(current);
+            leaf.status.store(expanded ? Node::Expanded : Node::Leaf,
+                              std::memory_order_release);
+        }
+
+        if constexpr (SEARCH_STATS) {
+            stats.expand_ns += nanos_since(phase);
+        }
 
-        float ucb = exploit + explore;
-        scores[i] = ucb;
+        // simulate
+        auto [depth, winner] = simulate(current, rng);
+        if constexpr (SEARCH_STATS) {
+            stats.simulate_ns += nanos_since(phase);
+            // the path holds the root and one node per move below it
+            int64_t leaf_depth = static_cast<int64_t>(length) - 1;
+            stats.iterations += 1;
+            stats.depth_sum += leaf_depth;
+            stats.max_depth = std::max(stats.max_depth, leaf_depth);
+            stats.rollout_moves += depth - leaf_depth;
+        }
+
+        // backprop along the path, as transposed nodes have several parents
+        for (size_t k = 0; k < length; k += 1) {
+            Node& node = tree.nodes[path[k]];
+
+            node.visits += 1;
+            node.vloss -= 1;
+            if (winner.has_value()) {
+                if (node.state.get_next() == winner.value()) {
+                    // this leads to a win => the parent node don't want this
+                    atomic_add(node.ttlvalue,
+                               -std::exp(-0.5f * (0.2f * depth - 5.0f)) - 5.0f);
+                } else {
+                    // this leads to a lose => the parent node is happy
+                    atomic_add(node.ttlvalue, 1.0f);
+                }
+            } else {
+                atomic_add(node.ttlvalue, 0.2f);
+            }
+        }
+        // proofs go up the path until a node stays undecided
+        if (leaf.proof.load(std::memory_order_relaxed) != Node::Unproven) {
+            for (size_t k = length - 1; k > 0 && prove(path[k - 1]); k -= 1) {
+            }
+            if (settled()) {
+                remaining.store(0, std::memory_order_relaxed);
+            }
+        }
+        if constexpr (SEARCH_STATS) {
+            stats.backprop_ns += nanos_since(phase);
+        }
+
+        until_check -= 1;
+        bool check_visits = until_check == 0;
+        if (check_visits) {
+            until_check = STOP_CHECK_INTERVAL;
+        }
+        if ((check_visits || move_ms > 0) &&
+            can_stop(remaining.load(std::memory_order_relaxed),
+                     check_visits)) {
+            // the other workers see it on their next iteration
+            remaining.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Mcts::can_stop(int remaining, bool check_visits) const {
+    remaining = std::max(0, remaining);
+    if (move_ms > 0) {
+        using Millis = std::chrono::duration<double, std::milli>;
+        double elapsed = Millis(Clock::now() - query_start).count();
+        if (elapsed >= move_ms) {
+            return true;
+        }
+        // iterations that fit in the time left at the rate so far
+        double rate = (iters - remaining) / elapsed;
+        double fit = rate * (move_ms - elapsed);
+        remaining = static_cast<int>(std::min<double>(remaining, fit));
+    }
+    if (!early_stop || !check_visits) {
+        return false;
     }
 
-    return scores;
+    // the runner-up gets at most every remaining iteration
+    const Node& node = tree.nodes[root];
+    if (node.status.load(std::memory_order_acquire) != Node::Expanded) {
+        return false;
+    }
+    int best = 0;
+    int second = 0;
+    for (NodeIdx e = 0; e < node.num_children; e += 1) {
+        NodeIdx child = tree.edges[node.first_edge + e].child.load(
+            std::memory_order_acquire);
+        int visits = (child != NO_NODE) ? tree.nodes[child].visits.load() : 0;
+        if (visits > best) {
+            second = best;
+            best = visits;
+        } else if (visits > second) {
+            second = visits;
+        }
+    }
+    return best - second > remaining;
 }
 
-NodePtr Mcts::sample_select(NodePtr current) {
+void Mcts::promote(NodeIdx node, NodeIdx extra_nodes, NodeIdx extra_edges) {
+    // Copy everything reachable from node breadth first. The copied nodes
+    // double as the queue, and origin maps them back to the old tree.
+    spare.reset(tree.nodes.size() + extra_nodes,
+                tree.edges.size() + extra_edges);
+    std::vector<NodeIdx> origin{};
+    std::vector<NodeIdx> moved(tree.nodes.size(), NO_NODE);
+
+    auto copy = [&](NodeIdx old) {
+        if (old != NO_NODE && moved[old] == NO_NODE) {
+            moved[old] = spare.table.find_or_insert(tree.nodes[old].state,
+                                                    spare.nodes);
+            // pending searches are over, so there are no virtual losses
+            new (&spare.nodes[moved[old]]) Node(tree.nodes[old]);
+            origin.push_back(old);
+        }
+        return (old != NO_NODE) ? moved[old] : NO_NODE;
+    };
+
+    root = copy(node);
+    for (NodeIdx k = 0; k < origin.size(); k += 1) {
+        const Node& source = tree.nodes[origin[k]];
+        if (source.num_children == 0) {
+            continue;
+        }
+
+        NodeIdx first = spare.edges.alloc(source.num_children);
+        for (NodeIdx e = 0; e < source.num_children; e += 1) {
+            const Edge& edge = tree.edges[source.first_edge + e];
+            new (&spare.edges[first + e])
+                Edge(copy(edge.child), edge.cell, edge.prior);
+        }
+        spare.nodes[moved[origin[k]]].first_edge = first;
+    }
+
+    swap(tree, spare);
+}
+
+NodeIdx Mcts::child_of(NodeIdx current, Edge& edge) {
+    NodeIdx child = edge.child.load(std::memory_order_acquire);
+    if (child == NO_NODE) {
+        // racing workers find the same node through the table
+        State to_state = tree.nodes[current].state;
+        to_state.place(Action::from_cell(edge.cell));
+        child = tree.table.find_or_insert(to_state, tree.nodes);
+        edge.child.store(child, std::memory_order_release);
+    }
+    return child;
+}
+
+float Mcts::child_score(const Node& parent, const Edge& edge) const {
+    float parent_visits = static_cast<float>(parent.visits);
+    float child_visits = 0.0f;
+    float child_value = 0.0f;
+    NodeIdx child = edge.child.load(std::memory_order_acquire);
+    if (child != NO_NODE) {
+        // searches in flight count as visits that went badly
+        const Node& node = tree.nodes[child];
+        float vloss = static_cast<float>(node.vloss.load());
+        child_visits = static_cast<float>(node.visits) + vloss;
+        child_value = node.ttlvalue - VIRTUAL_LOSS * vloss;
+    }
+
+    float exploit = child_value / (child_visits + 1.0f);
+    if (evaluator != nullptr) {
+        // PUCT
+        float explore = CPUCT * edge.prior * std::sqrt(parent_visits) /
+                        (child_visits + 1.0f);
+        return exploit + explore;
+    }
+
+    float explore = std::sqrt(2.0f * std::log(std::max(1.0f, parent_visits)) /
+                              (child_visits + 1.0f));
+    return exploit + explore;
+}
+
+const Edge& Mcts::sample_select(NodeIdx current) {
+    const Node& node = tree.nodes[current];
     std::vector<int> visits{};
-    for (auto& child : current->children) {
-        visits.push_back(child->visits);
+    // moves proven lost are left out, unless they are all lost
+    std::vector<int> unlost{};
+    for (NodeIdx e = 0; e < node.num_children; e += 1) {
+        NodeIdx child = tree.edges[node.first_edge + e].child;
+        int count = (child != NO_NODE) ? tree.nodes[child].visits.load() : 0;
+        bool lost = child != NO_NODE && tree.nodes[child].proof == Node::Win;
+        visits.push_back(count);
+        unlost.push_back(lost ? 0 : count);
+    }
+    if (std::accumulate(unlost.begin(), unlost.end(), 0) > 0) {
+        visits = unlost;
     }
 
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
     std::discrete_distribution<> dist(visits.begin(), visits.end());
-    int idx = dist(gen);
+    int idx = dist(rng);
 
-    return current->children[idx];
+    return tree.edges[node.first_edge + idx];
 }
 
-NodePtr Mcts::max_select(NodePtr current) {
-    auto scores = children_scores(current);
-    int idx = std::max_element(scores.begin(), scores.end()) - scores.begin();
+const Edge* Mcts::proven_select(NodeIdx current) const {
+    const Node& node = tree.nodes[current];
+    auto proof = node.proof.load(std::memory_order_relaxed);
+    if ((proof != Node::Win && proof != Node::Draw) ||
+        node.status.load(std::memory_order_acquire) != Node::Expanded) {
+        return nullptr;
+    }
 
-    return current->children[idx];
+    // the most visited child holding the outcome for us
+    auto wanted = (proof == Node::Win) ? Node::Loss : Node::Draw;
+    const Edge* best = nullptr;
+    int best_visits = -1;
+    for (NodeIdx e = 0; e < node.num_children; e += 1) {
+        const Edge& edge = tree.edges[node.first_edge + e];
+        NodeIdx child = edge.child.load(std::memory_order_acquire);
+        if (child != NO_NODE && tree.nodes[child].proof == wanted &&
+            tree.nodes[child].visits > best_visits) {
+            best = &edge;
+            best_visits = tree.nodes[child].visits;
+        }
+    }
+    return best;
 }
 
-void Mcts::expand(NodePtr current) {
-    auto actions = current->state.get_actions();
+bool Mcts::settled() const {
+    if (proven_select(root) != nullptr) {
+        return true;
+    }
+    const Node& node = tree.nodes[root];
+    if (node.proof.load(std::memory_order_relaxed) != Node::Loss ||
+        node.status.load(std::memory_order_acquire) != Node::Expanded ||
+        node.num_children == 0) {
+        return false;
+    }
+    // a lost root proven by the solver may still have unrefuted moves
+    for (NodeIdx e = 0; e < node.num_children; e += 1) {
+        NodeIdx child = tree.edges[node.first_edge + e].child.load(
+            std::memory_order_acquire);
+        if (child == NO_NODE ||
+            tree.nodes[child].proof.load(std::memory_order_relaxed) !=
+                Node::Win) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    for (auto action : actions) {
-        State to_state = current->state;
-        to_state.place(action);
+Edge& Mcts::max_select(NodeIdx current) {
+    const Node& node = tree.nodes[current];
+    NodeIdx best = NO_NODE;
+    float best_score = -std::numeric_limits<float>::infinity();
+    // lost moves are only taken when there is nothing else
+    NodeIdx best_lost = node.first_edge;
+    float best_lost_score = -std::numeric_limits<float>::infinity();
+    for (NodeIdx e = node.first_edge; e < node.first_edge + node.num_children;
+         e += 1) {
+        NodeIdx child = tree.edges[e].child.load(std::memory_order_acquire);
+        float score = child_score(node, tree.edges[e]);
+        if (child != NO_NODE && tree.nodes[child].proof.load(
+                                    std::memory_order_relaxed) == Node::Win) {
+            if (score > best_lost_score) {
+                best_lost_score = score;
+                best_lost = e;
+            }
+        } else if (score > best_score) {
+            best_score = score;
+            best = e;
+        }
+    }
+
+    return tree.edges[(best != NO_NODE) ? best : best_lost];
+}
+
+bool Mcts::expand(NodeIdx current) {
+    Node& node = tree.nodes[current];
+    Bitboard empty = node.state.get_empty();
+    NodeIdx first = tree.edges.alloc(bit_count(empty));
+    if (first == NO_NODE) {
+        return false;
+    }
+
+    // priors renormalized over the legal moves
+    Policy priors{};
+    if (evaluator != nullptr) {
+        priors = evaluator->evaluate(node.state);
+        float legal = 0.0f;
+        for (Bitboard rest = empty; rest != 0; rest &= rest - 1) {
+            legal += priors[lowest_cell(rest)];
+        }
+        float count = static_cast<float>(bit_count(empty));
+        for (float& prior : priors) {
+            prior = (legal > 0.0f) ? prior / legal : 1.0f / count;
+        }
+    }
+
+    NodeIdx edge = first;
+    while (empty != 0) {
+        int cell = lowest_cell(empty);
+        empty &= empty - 1;
+
+        new (&tree.edges[edge])
+            Edge(NO_NODE, static_cast<uint8_t>(cell), priors[cell]);
+        edge += 1;
+    }
+
+    // published to other workers by the status store in search()
+    node.first_edge = first;
+    node.num_children = edge - first;
+    return true;
+}
+
+void Mcts::solve_leaf(NodeIdx current, Solver& solver, SearchStats& stats) {
+    auto result = solver.solve(tree.nodes[current].state, SOLVE_NODES);
+    if (!result.has_value()) {
+        tree.nodes[current].unsolved.store(true, std::memory_order_relaxed);
+        if constexpr (SEARCH_STATS) {
+            stats.unsolved += 1;
+        }
+        return;
+    }
+    if constexpr (SEARCH_STATS) {
+        stats.solved += 1;
+    }
+    Node::Proof proof = Node::Draw;
+    if (result->value == Solver::WIN) {
+        proof = Node::Win;
+    } else if (result->value == Solver::LOSS) {
+        proof = Node::Loss;
+    }
+    tree.nodes[current].proof.store(proof, std::memory_order_relaxed);
+}
+
+bool Mcts::prove(NodeIdx current) {
+    Node& node = tree.nodes[current];
+    if (node.proof.load(std::memory_order_relaxed) != Node::Unproven) {
+        return true;
+    }
+    if (node.status.load(std::memory_order_acquire) != Node::Expanded) {
+        return false;
+    }
 
-        auto child = std::make_shared<Node>(to_state, action, current);
-        current->children.push_back(child);
+    // values of the children are for the opponent
+    bool decided = true;
+    bool drawn = false;
+    for (NodeIdx e = 0; e < node.num_children; e += 1) {
+        NodeIdx child = tree.edges[node.first_edge + e].child.load(
+            std::memory_order_acquire);
+        auto proof = (child != NO_NODE)
+                         ? tree.nodes[child].proof.load(
+                               std::memory_order_relaxed)
+                         : Node::Unproven;
+        if (proof == Node::Loss) {
+            node.proof.store(Node::Win, std::memory_order_relaxed);
+            return true;
+        }
+        decided = decided && proof != Node::Unproven;
+        drawn = drawn || proof == Node::Draw;
+    }
+    if (!decided || node.num_children == 0) {
+        return false;
     }
+    node.proof.store(drawn ? Node::Draw : Node::Loss,
+                     std::memory_order_relaxed);
+    return true;
 }
 
-std::pair<int, std::optional<Player>> Mcts::simulate(NodePtr current) {
-    // state is to be modified in-place
-    State state{current->state};
+std::pair<int, std::optional<Player>> Mcts::simulate(NodeIdx current,
+                                                    Rng& rng) {
+    const Node& node = tree.nodes[current];
+    int depth = node.state.get_age() - tree.nodes[root].state.get_age();
+
+    // proven outcomes count as decided at the node
+    Player me = node.state.get_next();
+    switch (node.proof.load(std::memory_order_relaxed)) {
+    case Node::Win:
+        return {depth, me};
+    case Node::Loss:
+        return {depth, !me};
+    case Node::Draw:
+        return {depth, std::nullopt};
+    case Node::Unproven:
+        break;
+    }
+
+    State state{node.state};
+    int moves = random_playout(state, rng);
+    return {depth + moves, state.get_winner()};
+}
+
+int random_playout(State& state, Rng& rng) {
+    // state is modified in-place, and the empty cells are tracked alongside
+    // it so that no action list is built per ply
+    Bitboard empty = state.get_empty();
     int i = 0;
     while (state.is_ended() == false) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-
         i += 1;
 
-        auto actions = state.get_actions();
-        std::uniform_int_distribution<> dist(0, actions.size() - 1);
-        Action action = actions[dist(gen)];
-        state.place(action);
+        int cell = nth_cell(empty, rng.below(bit_count(empty)));
+        empty &= ~cell_bit<Bitboard>(cell);
+        state.place(Action::from_cell(cell));
     }
-    return {current->depth + i, state.get_winner()};
+    return i;
 }
 
 std::ostream& operator<<(std::ostream& out, const Node& node) {
@@ -185,4 +812,71 @@ std::ostream& operator<<(std::ostream& out, const Node& node) {
     return out;
 }
 
-void show_iters() { fmt::print("Using ITERS = {}\n", ITERS); }
+int default_iters() { return ITERS; }
+int default_threads() { return THREADS; }
+int default_solve_empty() { return SOLVE_EMPTY; }
+std::string default_book_path() { return BOOK_S ? BOOK_S : "book.bin"; }
+
+std::shared_ptr<const OpeningBook> default_book() {
+    // The file is checked on every call and loaded again once it is
+    // replaced, so a long run picks up a rebuilt book with its next Mcts.
+    // Identity is device, inode, size and modification time, all zero while
+    // the file is missing.
+    using Identity = std::array<int64_t, 4>;
+    static std::mutex mutex;
+    static std::shared_ptr<const OpeningBook> book = nullptr;
+    static std::optional<Identity> loaded_from = std::nullopt;
+
+    std::string path = default_book_path();
+    Identity identity{};
+    struct stat info {};
+    if (stat(path.c_str(), &info) == 0) {
+        identity = {static_cast<int64_t>(info.st_dev),
+                    static_cast<int64_t>(info.st_ino),
+                    static_cast<int64_t>(info.st_size),
+                    info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec};
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loaded_from == identity) {
+        return book;
+    }
+    bool reloading = loaded_from.has_value();
+    loaded_from = identity;
+    book = nullptr;
+    if (identity == Identity{}) {
+        // running without a book is the normal case
+        if (BOOK_S != nullptr || reloading) {
+            fmt::print(FGRED, "Opening book {} is missing\n", path);
+        }
+        return book;
+    }
+    try {
+        book = std::make_shared<const OpeningBook>(path);
+    } catch (const std::exception& e) {
+        fmt::print(FGRED, "{}\n", e.what());
+    }
+    if (book != nullptr && reloading) {
+        fmt::print("Reloaded opening book {} ({} positions)\n", path,
+                   book->size());
+    }
+    return book;
+}
+uint64_t default_solve_nodes() { return SOLVE_NODES; }
+
+void show_iters() {
+    fmt::print("Using ITERS = {}\n", ITERS);
+    fmt::print("Using THREADS = {}\n", THREADS);
+    fmt::print("Using REUSE = {}\n", REUSE);
+    fmt::print("Using CPUCT = {}\n", CPUCT);
+    fmt::print("Using MOVE_MS = {}\n", MOVE_MS);
+    fmt::print("Using EARLY_STOP = {}\n", EARLY_STOP);
+    fmt::print("Using SOLVE_EMPTY = {}\n", SOLVE_EMPTY);
+    fmt::print("Using SOLVE_NODES = {}\n", SOLVE_NODES);
+    if (auto book = default_book()) {
+        fmt::print("Using BOOK = {} ({} positions)\n", default_book_path(),
+                   book->size());
+    } else {
+        fmt::print("Using no BOOK\n");
+    }
+}
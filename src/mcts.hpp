@@ -1,51 +1,272 @@
 #pragma once
 
+#include "evaluator.hpp"
 #include "game.hpp"
 #include "model.hpp"
+#include "opening_book.hpp"
+#include "rng.hpp"
+#include "search_stats.hpp"
+#include "solver.hpp"
 #include "tensor_utils.hpp"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cassert>
 #include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <type_traits>
 #include <ostream>
 #include <vector>
 
 #include <torch/torch.h>
 
+// index of a node inside its arena
+using NodeIdx = uint32_t;
+constexpr NodeIdx NO_NODE = std::numeric_limits<NodeIdx>::max();
+
+// Transposed positions share one node, so the tree is really a DAG. Nodes
+// don't know their parents; backprop follows the path taken by the iteration.
 struct Node {
-    Node(State state, std::optional<Action> last_action,
-         std::shared_ptr<Node> parent);
+    explicit Node(State state);
+    // copies a quiescent node, i.e. while no search is running
+    Node(const Node& rhs);
+
+    enum Status : uint8_t { Leaf, Expanding, Expanded };
+    // exact outcome for the player to move, once known. Set at creation for
+    // ended games, by the solver, or from the children.
+    enum Proof : uint8_t { Unproven, Win, Loss, Draw };
+
     State state;
-    int visits = 0;
-    float ttlvalue = 0.0f;
-    int depth = 0;
+    std::atomic<int> visits = 0;
+    std::atomic<float> ttlvalue = 0.0f;
 
-    std::optional<Action> last_action;
-    std::weak_ptr<Node> parent;
-    std::vector<std::shared_ptr<Node>> children{};
+    // edges to the children are allocated as one contiguous block, and are
+    // only read once status is Expanded
+    NodeIdx first_edge = NO_NODE;
+    // searches currently passing through this node
+    std::atomic<uint16_t> vloss = 0;
+    uint8_t num_children = 0;
+    std::atomic<Status> status = Leaf;
+    std::atomic<Proof> proof = Unproven;
+    // the solver ran out of budget here, so it isn't tried again
+    std::atomic<bool> unsolved = false;
 
     friend std::ostream& operator<<(std::ostream& out, const Node& node);
 };
 std::ostream& operator<<(std::ostream& out, const Node& node);
 
-using NodePtr = std::shared_ptr<Node>;
+// Children are only created, or looked up in the table, when their edge is
+// first selected.
+struct Edge {
+    Edge(NodeIdx child, uint8_t cell, float prior);
+    Edge(const Edge& rhs);
+
+    std::atomic<NodeIdx> child = NO_NODE;
+    // probability of the action from the evaluator, only used by PUCT
+    float prior = 0.0f;
+    // cell of the action taken along this edge
+    uint8_t cell = 0;
+};
+// cells and child counts are kept in a byte
+static_assert(BOARD_CELLS <= 255, "board too large for Edge::cell");
+
+// Bump allocator holding the nodes (or edges) of one search tree. Memory is
+// kept between searches, so dropping a whole tree is O(1). Allocation is
+// thread-safe.
+template <typename T> class Arena {
+    static_assert(std::is_trivially_destructible_v<T>);
+
+  public:
+    // drop all items and make room for at least capacity of them
+    void reset(NodeIdx new_capacity) {
+        if (new_capacity > capacity) {
+            storage.reset(new std::byte[sizeof(T) * new_capacity]);
+            capacity = new_capacity;
+        }
+        used = 0;
+    }
+
+    // allocate count consecutive items, NO_NODE if the arena is full
+    NodeIdx alloc(NodeIdx count) {
+        // a failed allocation leaves used past capacity, so later ones fail
+        NodeIdx first = used.fetch_add(count, std::memory_order_relaxed);
+        if (first > capacity || count > capacity - first) {
+            return NO_NODE;
+        }
+        return first;
+    }
+
+    T& operator[](NodeIdx idx) { return items()[idx]; }
+    const T& operator[](NodeIdx idx) const { return items()[idx]; }
+    NodeIdx size() const { return std::min(used.load(), capacity); }
+
+    friend void swap(Arena& lhs, Arena& rhs) {
+        std::swap(lhs.storage, rhs.storage);
+        std::swap(lhs.capacity, rhs.capacity);
+        NodeIdx used = lhs.used.load();
+        lhs.used = rhs.used.load();
+        rhs.used = used;
+    }
 
+  private:
+    T* items() const { return reinterpret_cast<T*>(storage.get()); }
+
+    // left uninitialized until allocated, so untouched pages cost nothing
+    std::unique_ptr<std::byte[]> storage{};
+    std::atomic<NodeIdx> used = 0;
+    NodeIdx capacity = 0;
+};
+
+using NodeArena = Arena<Node>;
+using EdgeArena = Arena<Edge>;
+
+// Transposition table from zobrist hash to node, with open addressing. Slots
+// are tagged with an epoch, so clearing is O(1) as well. Lookups and inserts
+// are thread-safe.
+class NodeTable {
+  public:
+    // drop all entries and make room for at least capacity of them
+    void reset(NodeIdx capacity);
+    // node holding state, NO_NODE if there is none
+    NodeIdx find(const State& state, const NodeArena& nodes) const;
+    // node holding state, which is allocated from nodes if missing
+    NodeIdx find_or_insert(const State& state, NodeArena& nodes);
+
+    friend void swap(NodeTable& lhs, NodeTable& rhs);
+
+  private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots{};
+    size_t mask = 0;
+    uint64_t epoch = 0;
+};
+
+// A search tree with its own storage.
+struct Tree {
+    NodeArena nodes{};
+    EdgeArena edges{};
+    NodeTable table{};
+
+    // drop everything and make room for the given number of nodes & edges
+    void reset(NodeIdx node_capacity, NodeIdx edge_capacity);
+    friend void swap(Tree& lhs, Tree& rhs);
+};
+
+// The tree is kept between queries. When the next queried state is a
+// descendant of the previous root, its subtree and statistics are reused.
+//
+// With more than one thread, the workers search the same tree at once. Virtual
+// loss on the nodes along each selected path steers the other workers towards
+// different branches.
+//
+// Without an evaluator, children are selected by UCB1. With one, every newly
+// expanded node is evaluated and selection follows PUCT with the resulting
+// priors.
+//
+// Proven outcomes are propagated up the path of every iteration: a node is
+// won once a child is lost for its player, and lost (or drawn) once every
+// child is proven. Selection stops at proven nodes and avoids children won
+// by the opponent. A query ends as soon as its root is won or drawn through
+// a child, or lost with every child won by the opponent.
 class Mcts {
   public:
     Mcts();
-    std::pair<Action, std::array<float, 36>> query(State state);
+    explicit Mcts(int threads, std::shared_ptr<Evaluator> evaluator = nullptr);
+    explicit Mcts(std::shared_ptr<Evaluator> evaluator);
+    std::pair<Action, Policy> query(State state);
+    // Restarts the random stream of the search, which is seeded from
+    // std::random_device otherwise. Searches are reproducible with one
+    // thread and a deterministic evaluator.
+    void seed(uint64_t seed);
+    // iterations per query, ITERS by default. This is also the node budget,
+    // as every iteration adds at most one node.
+    void set_iters(int iters);
+    // wall clock limit per query in milliseconds, MOVE_MS by default and
+    // unlimited if 0. The search stops at whichever of the iteration and
+    // time budget runs out first, so timed searches are not reproducible.
+    void set_move_time(int move_ms);
+    // whether a query may end once its move is settled, EARLY_STOP by
+    // default
+    void set_early_stop(bool early_stop);
+    // book consulted before searching, the one at BOOK by default. nullptr
+    // turns it off.
+    void set_book(std::shared_ptr<const OpeningBook> book);
+    // counters of the last query, and of all queries so far. Only collected
+    // when built with MCTS_STATS.
+    const SearchStats& last_stats() const { return query_stats; }
+    const SearchStats& stats() const { return total_stats; }
 
   private:
-    NodePtr sample_select(NodePtr current);
-    NodePtr max_select(NodePtr current);
-    std::vector<float> children_scores(NodePtr current);
-    void expand(NodePtr current);
-    // depth and winner
-    std::pair<int, std::optional<Player>> simulate(NodePtr current);
+    // make the subtree under node the whole tree, with room for extra nodes
+    // and edges
+    void promote(NodeIdx node, NodeIdx extra_nodes, NodeIdx extra_edges);
+    // run iterations until remaining drops to zero
+    void search(std::atomic<int>& remaining, Rng& rng, SearchStats& stats,
+                Solver* solver);
+    // whether the query is over with remaining iterations left: the time is
+    // up, or with EARLY_STOP and check_visits the most visited root child
+    // can't be overtaken by the iterations that fit in the budget
+    bool can_stop(int remaining, bool check_visits) const;
+    const Edge& sample_select(NodeIdx current);
+    // edge to play from a proven root, nullptr if the root is unproven or
+    // lost
+    const Edge* proven_select(NodeIdx current) const;
+    // whether more iterations can't change the move: the root is won or
+    // drawn through a child, or every root child is won by the opponent
+    bool settled() const;
+    Edge& max_select(NodeIdx current);
+    // child behind edge, created on first use; NO_NODE if out of room
+    NodeIdx child_of(NodeIdx current, Edge& edge);
+    float child_score(const Node& parent, const Edge& edge) const;
+    // false if the edge arena is out of room
+    bool expand(NodeIdx current);
+    // proves a leaf close to the end with solver if within budget, and marks
+    // it unsolved otherwise
+    void solve_leaf(NodeIdx current, Solver& solver, SearchStats& stats);
+    // proves current from its children, false if they don't decide it yet
+    bool prove(NodeIdx current);
+    // depth and winner, exact for proven nodes
+    std::pair<int, std::optional<Player>> simulate(NodeIdx current, Rng& rng);
+
+    int threads;
+    int iters;
+    int move_ms;
+    bool early_stop;
+    std::shared_ptr<const OpeningBook> book;
+    std::chrono::steady_clock::time_point query_start{};
+    std::shared_ptr<Evaluator> evaluator;
+    Tree tree{};
+    // previous tree, kept around as the target of promote()
+    Tree spare{};
+    NodeIdx root = NO_NODE;
+    // for the final move choice and the rollouts of the calling thread,
+    // other workers get streams split off it
+    Rng rng;
+    // one per search thread, kept for their tables; empty unless SOLVE_EMPTY
+    std::vector<Solver> solvers{};
+    SearchStats query_stats{};
+    SearchStats total_stats{};
 };
 
+// plays uniformly random moves on state until the game ends, returns the
+// number of moves played
+int random_playout(State& state, Rng& rng);
+
+int default_iters();
+int default_threads();
+// leaves with at most this many empty cells are solved exactly, SOLVE_EMPTY
+int default_solve_empty();
+// node budget per solved leaf, SOLVE_NODES
+uint64_t default_solve_nodes();
+// book file, BOOK or book.bin
+std::string default_book_path();
+// the book at default_book_path(), nullptr if there is none or it doesn't
+// load. It is loaded again whenever the file is replaced.
+std::shared_ptr<const OpeningBook> default_book();
 void show_iters();
@@ -1,4 +1,5 @@
 #include "model.hpp"
+#include "game.hpp"
 
 #include <fmt/core.h>
 #include <fmt/ostream.h>
@@ -43,11 +44,7 @@ void dump_text(Tensor x, std::string name) {
 }
 
 void dump_bin(Tensor x, std::string name) {
-    float SCALE = 2.5f;
-    if (const char* scale = std::getenv("SCALE")) {
-        fmt::print("Using supplied scale {}\n", scale);
-        SCALE = std::atof(scale);
-    }
+    float SCALE = quantization_scale();
 
     auto fname = name + ".bin";
 
@@ -58,10 +55,7 @@ void dump_bin(Tensor x, std::string name) {
     std::ofstream file(fname);
     for (int i = 0; i < numel; i += 1) {
         float f = static_cast<float*>(x.data_ptr())[i];
-        int16_t quantized = std::clamp(
-            static_cast<int16_t>(std::round(SCALE * f * std::pow(2, 8))),
-            std::numeric_limits<int16_t>::min(),
-            std::numeric_limits<int16_t>::max());
+        int16_t quantized = quantize(f, SCALE);
         if (quantized == std::numeric_limits<int16_t>::min() ||
             quantized == std::numeric_limits<int16_t>::max()) {
             fmt::print(stderr, "truncated\n");
@@ -84,6 +78,22 @@ void dump(Tensor x, std::string name) {
 }
 } // namespace
 
+int16_t quantize(float f, float scale) {
+    // clamp before narrowing, so that out of range values saturate
+    float scaled = std::round(scale * f * std::pow(2.0f, 8));
+    return static_cast<int16_t>(std::clamp(
+        scaled, static_cast<float>(std::numeric_limits<int16_t>::min()),
+        static_cast<float>(std::numeric_limits<int16_t>::max())));
+}
+
+float quantization_scale() {
+    if (const char* scale = std::getenv("SCALE")) {
+        fmt::print("Using supplied scale {}\n", scale);
+        return std::atof(scale);
+    }
+    return 2.5f;
+}
+
 void NetImpl::dump_parameters() {
     dump(conv1->weight, "conv1.weight");
     auto conv1_slice0 = conv1->weight.index({Slice(0, 1), "..."});
@@ -148,13 +158,14 @@ Tensor NetImpl::manual_forward(Tensor x) {
     fmt::print("after mconv1:\n{}\n", conv1_out);
     /*******************************************************/
 
-    // 20,1,8,8
+    // 20, 1, BOARD_SIZE + 2, BOARD_SIZE + 2
     conv1_out = nn::functional::pad(conv1_out, padopts);
 
     std::vector<Tensor> conv2_outs{};
     for (int i = 0; i < 20; i += 1) {
-        Tensor summed = torch::zeros(
-            {1, 1, 6, 6}, torch::TensorOptions().dtype(torch::kFloat32));
+        Tensor summed =
+            torch::zeros({1, 1, BOARD_SIZE, BOARD_SIZE},
+                         torch::TensorOptions().dtype(torch::kFloat32));
         for (int j = 0; j < 20; j += 1) {
             Tensor featmap = conv1_out.index({Slice(j, j + 1), "..."});
             Tensor filter =
@@ -178,7 +189,7 @@ Tensor NetImpl::manual_forward(Tensor x) {
 
     conv2_out = nn::functional::pad(conv2_out, padopts);
 
-    Tensor summed = torch::zeros({1, 1, 6, 6},
+    Tensor summed = torch::zeros({1, 1, BOARD_SIZE, BOARD_SIZE},
                                  torch::TensorOptions().dtype(torch::kFloat32));
     for (int i = 0; i < 20; i += 1) {
         Tensor featmap = conv2_out.index({Slice(i, i + 1), "..."});
@@ -20,3 +20,9 @@ class NetImpl : public nn::Module {
 };
 
 TORCH_MODULE(Net);
+
+// Fixed-point format of the parameters dumped by dump_parameters:
+// round(scale * 2^8 * f), saturated to int16
+int16_t quantize(float f, float scale);
+// scale for quantize, from SCALE or 2.5 by default
+float quantization_scale();
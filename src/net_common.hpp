@@ -0,0 +1,45 @@
+#pragma once
+
+#include "game.hpp"
+#include "model.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Internals shared by the CPU inference engines, FastNet and QuantNet. Both
+// run every layer over the board with a zero border of one cell.
+namespace net_common {
+constexpr int SIDE = BOARD_SIZE + 2;
+constexpr int CELLS = SIDE * SIDE;
+
+// offsets of the 3x3 taps in the bordered board, in kernel order. The tenth
+// entry pads the taps to whole pairs for QuantNet and always meets a zero
+// weight there.
+constexpr int TAP_OFFSET[10] = {
+    -SIDE - 1, -SIDE, -SIDE + 1, -1, 0, 1, SIDE - 1, SIDE, SIDE + 1, 0,
+};
+
+// position of board cell in the bordered board
+constexpr int bordered(int cell) {
+    return (cell / BOARD_SIZE + 1) * SIDE + cell % BOARD_SIZE + 1;
+}
+
+inline std::vector<float> cpu_values(Tensor tensor) {
+    tensor = tensor.detach().to(torch::kCPU).contiguous();
+    const float* data = tensor.data_ptr<float>();
+    return std::vector<float>(data, data + tensor.numel());
+}
+
+inline void log_softmax(const float* logits, float* output) {
+    float max = *std::max_element(logits, logits + BOARD_CELLS);
+    float sum = 0.0f;
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        sum += std::exp(logits[c] - max);
+    }
+    float shift = max + std::log(sum);
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        output[c] = logits[c] - shift;
+    }
+}
+} // namespace net_common
@@ -1,21 +1,19 @@
 #include "net_query.hpp"
 
-NetQuery::NetQuery(Net net) : net(net) {}
+NetQuery::NetQuery(Net net)
+    : net(net),
+      evaluator(cached_evaluator(std::make_shared<NetEvaluator>(net))) {}
 
 std::pair<Action, Policy> NetQuery::raw_query(State state) {
-    auto canonical = state.canonical();
-    auto options = torch::TensorOptions().dtype(torch::kFloat32);
-    auto input = torch::from_blob(canonical.data(), {1, 1, 6, 6}, options);
-
-    auto policy_t = net->forward(input);
-    policy_t = policy_t.exp();
-    Policy policy = policy_from_tensor(policy_t);
+    Policy policy = evaluator->evaluate(state);
 
     auto actions = state.get_actions();
     auto action = std::max_element(
         actions.begin(), actions.end(), [&](Action a, Action b) {
-            return policy[a.i * 6 + a.j] < policy[b.i * 6 + b.j];
+            return policy[a.cell()] < policy[b.cell()];
         });
 
     return {*action, policy};
 }
+
+void NetQuery::report() const { evaluator->report(); }
@@ -1,14 +1,21 @@
 #pragma once
 
+#include "evaluator.hpp"
 #include "game.hpp"
 #include "model.hpp"
 #include "tensor_utils.hpp"
 
+#include <memory>
+
 class NetQuery {
   public:
     NetQuery(Net net);
-    std::pair<Action, std::array<float, 36>> raw_query(State state);
+    std::pair<Action, Policy> raw_query(State state);
+    // statistics of the evaluation cache
+    void report() const;
 
   private:
     Net net;
+    // network memoized according to EVAL_CACHE
+    std::shared_ptr<Evaluator> evaluator;
 };
@@ -0,0 +1,187 @@
+#include "opening_book.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+namespace {
+constexpr char MAGIC[8] = {'G', 'M', 'K', 'B', 'O', 'O', 'K', '2'};
+
+struct Header {
+    char magic[8];
+    uint32_t entry_size;
+    // the game the book was built for
+    uint16_t board_size;
+    uint16_t win_length;
+    uint64_t count;
+};
+
+[[noreturn]] void fail(const std::string& what, const std::string& path) {
+    throw std::runtime_error(
+        fmt::format("opening book {}: {}: {}", path, what, strerror(errno)));
+}
+
+using Key = std::pair<Bitboard, Bitboard>;
+
+Key key_of(const State& state, int symmetry) {
+    Player me = state.get_next();
+    return {transform_board(symmetry, state.get_stones(me)),
+            transform_board(symmetry, state.get_stones(!me))};
+}
+} // namespace
+
+struct OpeningBook::Entry {
+    Bitboard mine;
+    Bitboard theirs;
+    uint16_t policy[BOARD_CELLS];
+    uint8_t cell;
+    // up to a multiple of 8 bytes
+    uint8_t reserved[7 - (2 * BOARD_CELLS) % 8];
+};
+
+int canonical_symmetry(const State& state) {
+    int best = 0;
+    Key best_key = key_of(state, 0);
+    for (int s = 1; s < SYMMETRIES; s += 1) {
+        Key key = key_of(state, s);
+        if (key < best_key) {
+            best = s;
+            best_key = key;
+        }
+    }
+    return best;
+}
+
+OpeningBook::OpeningBook(std::string path) : path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fail("cannot open", path);
+    }
+    struct stat info {};
+    Header header{};
+    if (fstat(fd, &info) != 0 ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.entry_size != sizeof(Entry) ||
+        static_cast<uint64_t>(info.st_size) !=
+            sizeof(Header) + header.count * sizeof(Entry)) {
+        close(fd);
+        throw std::runtime_error(
+            fmt::format("opening book {}: not an opening book", path));
+    }
+    if (header.board_size != BOARD_SIZE || header.win_length != WIN_LENGTH) {
+        close(fd);
+        throw std::runtime_error(fmt::format(
+            "opening book {}: built for {}x{} with {} in a row, not {}x{} "
+            "with {}",
+            path, header.board_size, header.board_size, header.win_length,
+            BOARD_SIZE, BOARD_SIZE, WIN_LENGTH));
+    }
+
+    count = header.count;
+    mapped_size = info.st_size;
+    void* addr = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        fail("cannot map", path);
+    }
+    mapped = static_cast<const char*>(addr);
+}
+
+OpeningBook::~OpeningBook() {
+    if (mapped != nullptr) {
+        munmap(const_cast<char*>(mapped), mapped_size);
+    }
+}
+
+void OpeningBook::write(const std::string& path,
+                        const std::vector<State>& states,
+                        const std::vector<std::pair<int, Policy>>& moves) {
+    std::vector<Entry> entries{};
+    for (size_t n = 0; n < states.size(); n += 1) {
+        int symmetry = canonical_symmetry(states[n]);
+        Key key = key_of(states[n], symmetry);
+        const auto& [cell, policy] = moves[n];
+
+        Entry entry{};
+        entry.mine = key.first;
+        entry.theirs = key.second;
+        entry.cell = static_cast<uint8_t>(transform_cell(symmetry, cell));
+        for (int c = 0; c < BOARD_CELLS; c += 1) {
+            float p = std::clamp(policy[c], 0.0f, 1.0f);
+            entry.policy[transform_cell(symmetry, c)] =
+                static_cast<uint16_t>(std::lround(p * 65535.0f));
+        }
+        entries.push_back(entry);
+    }
+    auto less = [](const Entry& lhs, const Entry& rhs) {
+        return Key{lhs.mine, lhs.theirs} < Key{rhs.mine, rhs.theirs};
+    };
+    auto same = [](const Entry& lhs, const Entry& rhs) {
+        return lhs.mine == rhs.mine && lhs.theirs == rhs.theirs;
+    };
+    std::stable_sort(entries.begin(), entries.end(), less);
+    entries.erase(std::unique(entries.begin(), entries.end(), same),
+                  entries.end());
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entry_size = sizeof(Entry);
+    header.board_size = BOARD_SIZE;
+    header.win_length = WIN_LENGTH;
+    header.count = entries.size();
+
+    // written aside and renamed over path, so readers never see half a book
+    std::string tmp = path + ".tmp";
+    FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        fail("cannot create", tmp);
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(entries.data(), sizeof(Entry), entries.size(),
+                          file) == entries.size() &&
+              std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        fail("write failed", path);
+    }
+}
+
+std::optional<std::pair<int, OpeningBook::Policy>>
+OpeningBook::find(const State& state) const {
+    int symmetry = canonical_symmetry(state);
+    Key key = key_of(state, symmetry);
+
+    auto first = reinterpret_cast<const Entry*>(mapped + sizeof(Header));
+    const Entry* last = first + count;
+    const Entry* found =
+        std::lower_bound(first, last, key, [](const Entry& entry, Key key) {
+            return Key{entry.mine, entry.theirs} < key;
+        });
+    if (found == last || found->mine != key.first ||
+        found->theirs != key.second) {
+        return std::nullopt;
+    }
+
+    // back to the orientation of state
+    int cell = -1;
+    Policy policy{};
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int stored = transform_cell(symmetry, c);
+        policy[c] = found->policy[stored] / 65535.0f;
+        if (stored == found->cell) {
+            cell = c;
+        }
+    }
+    return std::make_pair(cell, policy);
+}
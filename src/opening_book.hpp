@@ -0,0 +1,55 @@
+#pragma once
+
+#include "game.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Read-only table of searched opening positions, written by ./main book.
+// Positions are stored once per symmetry class, under the symmetry that
+// gives the smallest (stones to move, stones of the opponent) pair, and the
+// file is sorted by that key:
+//
+//     header: magic "GMKBOOK2", uint32 entry size, uint16 board size,
+//             uint16 win length, uint64 entry count
+//     entry:  Bitboard stones to move, Bitboard stones of the opponent,
+//             uint16 policy[BOARD_CELLS] in units of 1/65535, uint8 move,
+//             padding
+//
+// Lookups binary search a read-only memory map of the file.
+class OpeningBook {
+  public:
+    using Policy = std::array<float, BOARD_CELLS>;
+
+    // maps path, which has to be a book for BOARD_SIZE and WIN_LENGTH
+    explicit OpeningBook(std::string path);
+    ~OpeningBook();
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    // replaces path with a book of the given positions, their searched
+    // moves and policies. Symmetric duplicates keep the first occurrence.
+    static void write(const std::string& path,
+                      const std::vector<State>& states,
+                      const std::vector<std::pair<int, Policy>>& moves);
+
+    size_t size() const { return count; }
+    // move and policy of state, oriented like state
+    std::optional<std::pair<int, Policy>> find(const State& state) const;
+
+  private:
+    struct Entry;
+
+    std::string path;
+    const char* mapped = nullptr;
+    size_t mapped_size = 0;
+    size_t count = 0;
+};
+
+// symmetry taking state to the orientation it is stored under
+int canonical_symmetry(const State& state);
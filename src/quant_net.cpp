@@ -0,0 +1,323 @@
+#include "quant_net.hpp"
+#include "net_common.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <fmt/core.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QUANT_NET_X86 1
+#endif
+
+namespace {
+using net_common::bordered;
+using net_common::CELLS;
+using net_common::cpu_values;
+using net_common::TAP_OFFSET;
+
+int16_t saturate(int32_t x) {
+    return static_cast<int16_t>(
+        std::clamp<int32_t>(x, std::numeric_limits<int16_t>::min(),
+                            std::numeric_limits<int16_t>::max()));
+}
+
+// Q8 activation from an int32 accumulator, see QuantNet
+int16_t requantize(int32_t acc, int16_t multiplier) {
+    // the rounding add wraps like the vector one
+    int32_t rounded =
+        static_cast<int32_t>(static_cast<uint32_t>(acc) + 128u) >> 8;
+    int32_t t = saturate(rounded);
+    int32_t y = (t * multiplier + (1 << 14)) >> 15;
+    return static_cast<int16_t>(std::max(y, 0));
+}
+
+void log_softmax(const int16_t* logits, float* output) {
+    float values[BOARD_CELLS];
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        values[c] = logits[c] / 256.0f;
+    }
+    net_common::log_softmax(values, output);
+}
+} // namespace
+
+QuantNet::QuantNet(Net net, float scale) {
+    if (scale < 1.0f) {
+        fmt::print(stderr, "QuantNet needs scale >= 1, clamping {}\n", scale);
+        scale = 1.0f;
+    }
+    multiplier = saturate(std::lround(32768.0f / scale));
+
+    auto params = net->named_parameters();
+    auto conv1_w = cpu_values(params["conv1.weight"]);
+    auto conv1_b = cpu_values(params["conv1.bias"]);
+    auto conv2_w = cpu_values(params["conv2.weight"]);
+    auto conv2_b = cpu_values(params["conv2.bias"]);
+    auto conv3_w = cpu_values(params["conv3.weight"]);
+    auto conv3_b = cpu_values(params["conv3.bias"]);
+
+    // torch keeps [out][in][kh][kw], and the tap index is kh * 3 + kw.
+    // Biases are pre-shifted to the accumulator scale.
+    for (int oc = 0; oc < HIDDEN; oc += 1) {
+        for (int t = 0; t < TAPS; t += 1) {
+            w1[((t / 2) * CH + oc) * 2 + t % 2] =
+                quantize(conv1_w[oc * TAPS + t], scale);
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                w2[((t * HIDDEN / 2 + ic / 2) * CH + oc) * 2 + ic % 2] =
+                    quantize(conv2_w[(oc * HIDDEN + ic) * TAPS + t], scale);
+            }
+        }
+        b1[oc] = quantize(conv1_b[oc], scale) * 256;
+        b2[oc] = quantize(conv2_b[oc], scale) * 256;
+    }
+    for (int ic = 0; ic < HIDDEN; ic += 1) {
+        for (int t = 0; t < TAPS; t += 1) {
+            w3[t * CH + ic] = quantize(conv3_w[ic * TAPS + t], scale);
+        }
+    }
+    b3 = quantize(conv3_b[0], scale) * 256;
+
+#ifdef QUANT_NET_X86
+    avx2 = __builtin_cpu_supports("avx2");
+#else
+    avx2 = false;
+#endif
+}
+
+void QuantNet::forward(const float* input, float* output, int batch) const {
+    int16_t logits_q[BOARD_CELLS];
+    for (int b = 0; b < batch; b += 1) {
+        logits(input + b * BOARD_CELLS, logits_q);
+        log_softmax(logits_q, output + b * BOARD_CELLS);
+    }
+}
+
+Policy QuantNet::forward(const Canonical& canonical) const {
+    Policy policy;
+    forward(&canonical[0][0], policy.data(), 1);
+    return policy;
+}
+
+void QuantNet::logits(const float* input, int16_t* output,
+                      bool vectorized) const {
+    alignas(32) int16_t board[CELLS] = {};
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        board[bordered(c)] = saturate(std::lround(input[c] * 256.0f));
+    }
+    if (vectorized && avx2) {
+        logits_avx2(board, output);
+    } else {
+        logits_scalar(board, output);
+    }
+}
+
+// Accumulates in unsigned arithmetic, which wraps like the vector kernel
+// regardless of summation order
+void QuantNet::logits_scalar(const int16_t* board, int16_t* output) const {
+    alignas(32) int16_t act1[CELLS][CH] = {};
+    alignas(32) int16_t act2[CELLS][CH] = {};
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        uint32_t acc[CH];
+        std::copy(b1.begin(), b1.end(), acc);
+        for (int t = 0; t < TAPS; t += 1) {
+            int32_t x = board[p + TAP_OFFSET[t]];
+            const int16_t* w = &w1[(t / 2) * CH * 2 + t % 2];
+            for (int oc = 0; oc < CH; oc += 1) {
+                acc[oc] += static_cast<uint32_t>(x * w[oc * 2]);
+            }
+        }
+        for (int oc = 0; oc < CH; oc += 1) {
+            act1[p][oc] = requantize(static_cast<int32_t>(acc[oc]), multiplier);
+        }
+    }
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        uint32_t acc[CH];
+        std::copy(b2.begin(), b2.end(), acc);
+        for (int t = 0; t < TAPS; t += 1) {
+            const int16_t* in = act1[p + TAP_OFFSET[t]];
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                int32_t x = in[ic];
+                const int16_t* w =
+                    &w2[(t * HIDDEN / 2 + ic / 2) * CH * 2 + ic % 2];
+                for (int oc = 0; oc < CH; oc += 1) {
+                    acc[oc] += static_cast<uint32_t>(x * w[oc * 2]);
+                }
+            }
+        }
+        for (int oc = 0; oc < CH; oc += 1) {
+            act2[p][oc] = requantize(static_cast<int32_t>(acc[oc]), multiplier);
+        }
+    }
+
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        uint32_t acc = b3;
+        for (int t = 0; t < TAPS; t += 1) {
+            const int16_t* in = act2[p + TAP_OFFSET[t]];
+            for (int ic = 0; ic < HIDDEN; ic += 1) {
+                acc += static_cast<uint32_t>(in[ic] * w3[t * CH + ic]);
+            }
+        }
+        output[c] = requantize(static_cast<int32_t>(acc), multiplier);
+    }
+}
+
+#ifdef QUANT_NET_X86
+namespace {
+// two int16 as the int32 operand of madd, a in the low half
+int32_t pair(int16_t a, int16_t b) {
+    return static_cast<int32_t>(static_cast<uint16_t>(a) |
+                                static_cast<uint32_t>(b) << 16);
+}
+
+// adjacent channels as the int32 operand of madd
+int32_t load_pair(const int16_t* p) {
+    int32_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+__attribute__((target("avx2"))) __m256i load(const void* p) {
+    return _mm256_load_si256(static_cast<const __m256i*>(p));
+}
+
+// requantized Q8 activations of 16 channels from two accumulators of 8
+__attribute__((target("avx2"))) __m256i requantize16(__m256i acc0,
+                                                       __m256i acc1,
+                                                       __m256i multiplier) {
+    const __m256i round = _mm256_set1_epi32(128);
+    acc0 = _mm256_srai_epi32(_mm256_add_epi32(acc0, round), 8);
+    acc1 = _mm256_srai_epi32(_mm256_add_epi32(acc1, round), 8);
+    // packs works per 128 bit lane, so put the quadwords back in order
+    __m256i t = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc0, acc1), 0xd8);
+    __m256i y = _mm256_mulhrs_epi16(t, multiplier);
+    return _mm256_max_epi16(y, _mm256_setzero_si256());
+}
+
+// stores the 24 activations of a cell
+__attribute__((target("avx2"))) void store24(int16_t* out, __m256i acc0,
+                                               __m256i acc1, __m256i acc2,
+                                               __m256i multiplier) {
+    __m256i lo = requantize16(acc0, acc1, multiplier);
+    __m256i hi = requantize16(acc2, acc2, multiplier);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+                     _mm256_castsi256_si128(hi));
+}
+} // namespace
+
+__attribute__((target("avx2"))) void
+QuantNet::logits_avx2(const int16_t* board, int16_t* output) const {
+    alignas(32) int16_t act1[CELLS][CH] = {};
+    alignas(32) int16_t act2[CELLS][CH] = {};
+
+    const __m256i mult = _mm256_set1_epi16(multiplier);
+
+    // conv1: one input channel, so broadcast pairs of taps
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        __m256i acc0 = load(&b1[0]);
+        __m256i acc1 = load(&b1[8]);
+        __m256i acc2 = load(&b1[16]);
+        for (int k = 0; k < TAP_PAIRS; k += 1) {
+            int16_t even = board[p + TAP_OFFSET[2 * k]];
+            int16_t odd = board[p + TAP_OFFSET[2 * k + 1]];
+            __m256i x = _mm256_set1_epi32(pair(even, odd));
+            const int16_t* w = &w1[k * CH * 2];
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x, load(w)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x, load(w + 16)));
+            acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(x, load(w + 32)));
+        }
+        store24(act1[p], acc0, acc1, acc2, mult);
+    }
+
+    // conv2: broadcast input channel pairs of each tap, two cells at a time
+    // so that every weight load feeds two madds
+    for (int c = 0; c < BOARD_CELLS; c += 2) {
+        // an odd last cell is paired with itself
+        int p = bordered(c);
+        int q = bordered(std::min(c + 1, BOARD_CELLS - 1));
+        __m256i acc0 = load(&b2[0]);
+        __m256i acc1 = load(&b2[8]);
+        __m256i acc2 = load(&b2[16]);
+        __m256i acc3 = acc0;
+        __m256i acc4 = acc1;
+        __m256i acc5 = acc2;
+        for (int t = 0; t < TAPS; t += 1) {
+            const int16_t* in_p = act1[p + TAP_OFFSET[t]];
+            const int16_t* in_q = act1[q + TAP_OFFSET[t]];
+            const int16_t* w = &w2[t * HIDDEN * CH];
+            for (int ic = 0; ic < HIDDEN; ic += 2, w += CH * 2) {
+                __m256i w0 = load(w);
+                __m256i w1 = load(w + 16);
+                __m256i w2 = load(w + 32);
+                __m256i x = _mm256_set1_epi32(load_pair(in_p + ic));
+                __m256i y = _mm256_set1_epi32(load_pair(in_q + ic));
+                acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x, w0));
+                acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x, w1));
+                acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(x, w2));
+                acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(y, w0));
+                acc4 = _mm256_add_epi32(acc4, _mm256_madd_epi16(y, w1));
+                acc5 = _mm256_add_epi32(acc5, _mm256_madd_epi16(y, w2));
+            }
+        }
+        store24(act2[p], acc0, acc1, acc2, mult);
+        store24(act2[q], acc3, acc4, acc5, mult);
+    }
+
+    // conv3: single output, so madd along the input channels instead
+    for (int c = 0; c < BOARD_CELLS; c += 1) {
+        int p = bordered(c);
+        __m256i acc = _mm256_setzero_si256();
+        __m128i rest = _mm_setzero_si128();
+        for (int t = 0; t < TAPS; t += 1) {
+            const int16_t* in = act2[p + TAP_OFFSET[t]];
+            const int16_t* w = &w3[t * CH];
+            acc = _mm256_add_epi32(
+                acc, _mm256_madd_epi16(
+                         _mm256_loadu_si256(
+                             reinterpret_cast<const __m256i*>(in)),
+                         _mm256_loadu_si256(
+                             reinterpret_cast<const __m256i*>(w))));
+            rest = _mm_add_epi32(
+                rest,
+                _mm_madd_epi16(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 16))));
+        }
+        __m128i sum = _mm_add_epi32(rest, _mm256_castsi256_si128(acc));
+        sum = _mm_add_epi32(sum, _mm256_extracti128_si256(acc, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        int32_t total = static_cast<int32_t>(
+            static_cast<uint32_t>(_mm_cvtsi128_si32(sum)) +
+            static_cast<uint32_t>(b3));
+        output[c] = requantize(total, multiplier);
+    }
+    // the softmax that follows is SSE code, which would otherwise pay for
+    // the dirty upper halves of the ymm registers
+    _mm256_zeroupper();
+}
+#else
+void QuantNet::logits_avx2(const int16_t* board, int16_t* output) const {
+    logits_scalar(board, output);
+}
+#endif
+
+QuantNetEvaluator::QuantNetEvaluator(Net net) : quant(net) {}
+
+Policy QuantNetEvaluator::evaluate(const State& state) {
+    Policy policy = quant.forward(state.canonical());
+    for (float& p : policy) {
+        p = std::exp(p);
+    }
+    return policy;
+}
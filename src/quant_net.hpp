@@ -0,0 +1,73 @@
+#pragma once
+
+#include "evaluator.hpp"
+#include "model.hpp"
+#include "tensor_utils.hpp"
+
+#include <array>
+#include <cstdint>
+
+// Integer inference for NetImpl, in the fixed-point arithmetic of the
+// parameters written by dump_parameters. Weights and biases are int16
+// quantize(x, scale), activations are int16 with 8 fractional bits (Q8), and
+// every conv accumulates into int32. A layer output is requantized to Q8 as
+//
+//     acc = sum(w * x) + (b << 8)
+//     t = sat16((acc + 128) >> 8)           // about scale * 2^8 * y
+//     y = max(0, (t * M + 2^14) >> 15)      // M = round(2^15 / scale)
+//
+// which is exactly what _mm256_mulhrs_epi16 computes, so the scalar and AVX2
+// kernels produce identical logits. Accumulators wrap at 32 bits.
+class QuantNet {
+  public:
+    // scale as in quantize; at least 1 so that M fits in int16
+    explicit QuantNet(Net net, float scale = quantization_scale());
+
+    // log-probabilities like NetImpl::forward, for batch canonical boards of
+    // BOARD_CELLS floats each; only the final softmax is done in floating point
+    void forward(const float* input, float* output, int batch) const;
+    Policy forward(const Canonical& canonical) const;
+
+    // Q8 logits of a single board, the integer output of the network.
+    // vectorized = false forces the scalar kernel.
+    void logits(const float* input, int16_t* output,
+                bool vectorized = true) const;
+
+    bool uses_avx2() const { return avx2; }
+
+  private:
+    // channels padded to a multiple of the vector width
+    static constexpr int CH = 24;
+    static constexpr int HIDDEN = 20;
+    static constexpr int TAPS = 9;
+    // conv1 has a single input channel, so its taps are paired for madd
+    static constexpr int TAP_PAIRS = (TAPS + 1) / 2;
+
+    void logits_scalar(const int16_t* board, int16_t* output) const;
+    void logits_avx2(const int16_t* board, int16_t* output) const;
+
+    // weights are interleaved in pairs along the reduction axis, matching
+    // the operand layout of madd: [tap pair][output channel][2] for conv1
+    // and [tap][input channel pair][output channel][2] for conv2
+    alignas(32) std::array<int16_t, TAP_PAIRS * CH * 2> w1{};
+    alignas(32) std::array<int32_t, CH> b1{};
+    alignas(32) std::array<int16_t, TAPS * HIDDEN * CH> w2{};
+    alignas(32) std::array<int32_t, CH> b2{};
+    // last layer has a single output, so [tap][input channel]
+    alignas(32) std::array<int16_t, TAPS * CH> w3{};
+    int32_t b3 = 0;
+    // requantization multiplier
+    int16_t multiplier;
+
+    bool avx2;
+};
+
+// Evaluator running QuantNet on the calling thread
+class QuantNetEvaluator : public Evaluator {
+  public:
+    explicit QuantNetEvaluator(Net net);
+    Policy evaluate(const State& state) override;
+
+  private:
+    QuantNet quant;
+};
@@ -0,0 +1,185 @@
+#include "replay_buffer.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+namespace {
+constexpr char MAGIC[8] = {'G', 'M', 'K', 'R', 'P', 'L', 'Y', '1'};
+
+struct Header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t committed;
+};
+
+[[noreturn]] void fail(const std::string& what, const std::string& path) {
+    throw std::runtime_error(
+        fmt::format("replay buffer {}: {}: {}", path, what, strerror(errno)));
+}
+
+void write_all(int fd, const void* data, size_t size, off_t offset,
+               const std::string& path) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("write failed", path);
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+}
+} // namespace
+
+struct ReplayBuffer::Record {
+    uint32_t generation;
+    uint32_t reserved;
+    // cells holding +1 (the player to move) and -1 in the canonical board
+    Bitboard plus;
+    Bitboard minus;
+    float policy[BOARD_CELLS];
+};
+
+ReplayBuffer::ReplayBuffer(std::string path) : path(path) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fail("cannot open", path);
+    }
+
+    Header header{};
+    ssize_t got = pread(fd, &header, sizeof(header), 0);
+    if (got == 0) {
+        write_header();
+        if (fdatasync(fd) != 0) {
+            fail("sync failed", path);
+        }
+    } else if (got != sizeof(header) ||
+               std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+               header.record_size != sizeof(Record)) {
+        close(fd);
+        throw std::runtime_error(
+            fmt::format("replay buffer {}: not a replay buffer", path));
+    } else {
+        committed = header.committed;
+    }
+    map();
+}
+
+ReplayBuffer::~ReplayBuffer() {
+    if (mapped != nullptr) {
+        munmap(const_cast<char*>(mapped), mapped_size);
+    }
+    close(fd);
+}
+
+void ReplayBuffer::append(uint32_t generation,
+                          const std::vector<Sample>& samples) {
+    if (samples.empty()) {
+        return;
+    }
+
+    std::vector<Record> records(samples.size());
+    for (size_t n = 0; n < samples.size(); n += 1) {
+        auto& [state, policy] = samples[n];
+        Record& record = records[n];
+        record.generation = generation;
+        record.reserved = 0;
+        record.plus = 0;
+        record.minus = 0;
+        for (int cell = 0; cell < BOARD_CELLS; cell += 1) {
+            float value = state[cell / BOARD_SIZE][cell % BOARD_SIZE];
+            if (value > 0.0f) {
+                record.plus |= cell_bit<Bitboard>(cell);
+            } else if (value < 0.0f) {
+                record.minus |= cell_bit<Bitboard>(cell);
+            }
+        }
+        std::memcpy(record.policy, policy.data(), sizeof(record.policy));
+    }
+
+    // records first, then the count that makes them visible
+    off_t offset = sizeof(Header) + committed * sizeof(Record);
+    write_all(fd, records.data(), records.size() * sizeof(Record), offset,
+              path);
+    if (fdatasync(fd) != 0) {
+        fail("sync failed", path);
+    }
+    committed += records.size();
+    write_header();
+    if (fdatasync(fd) != 0) {
+        fail("sync failed", path);
+    }
+    map();
+}
+
+uint32_t ReplayBuffer::latest_generation() const {
+    return committed == 0 ? 0 : record(committed - 1).generation;
+}
+
+size_t ReplayBuffer::window_start(uint32_t generations) const {
+    uint32_t latest = latest_generation();
+    if (generations == 0 || generations > latest) {
+        return 0;
+    }
+    uint32_t first = latest - generations + 1;
+    size_t lo = 0;
+    size_t hi = committed;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (record(mid).generation < first) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void ReplayBuffer::read(size_t index, float* state, float* policy) const {
+    const Record& rec = record(index);
+    for (int cell = 0; cell < BOARD_CELLS; cell += 1) {
+        state[cell] = static_cast<float>(has_cell(rec.plus, cell)) -
+                      static_cast<float>(has_cell(rec.minus, cell));
+    }
+    std::memcpy(policy, rec.policy, sizeof(rec.policy));
+}
+
+const ReplayBuffer::Record& ReplayBuffer::record(size_t index) const {
+    return reinterpret_cast<const Record*>(mapped + sizeof(Header))[index];
+}
+
+void ReplayBuffer::write_header() {
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.record_size = sizeof(Record);
+    header.committed = committed;
+    write_all(fd, &header, sizeof(header), 0, path);
+}
+
+// maps the header and the committed records
+void ReplayBuffer::map() {
+    if (mapped != nullptr) {
+        munmap(const_cast<char*>(mapped), mapped_size);
+    }
+    mapped_size = sizeof(Header) + committed * sizeof(Record);
+    void* addr = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        mapped = nullptr;
+        fail("cannot map", path);
+    }
+    mapped = static_cast<const char*>(addr);
+    // training samples records in random order
+    madvise(addr, mapped_size, MADV_RANDOM);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "tensor_utils.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Append-only file of self-play samples, tagged with the generation that
+// played them. The file is a fixed header followed by fixed size records:
+//
+//     header: magic "GMKRPLY1", uint32 record size, uint32 reserved,
+//             uint64 committed record count
+//     record: uint32 generation, uint32 reserved, Bitboard cells at +1,
+//             Bitboard cells at -1, float policy[BOARD_CELLS]
+//
+// with Bitboard a uint64 up to 8x8 boards, so the record size tells boards
+// of different sizes apart.
+//
+// Records are synced to disk before the committed count is, so a crash
+// during an append leaves at most an uncommitted tail that the next append
+// overwrites. Reads go through a read-only memory map of the committed
+// records, and generations never decrease along the file.
+class ReplayBuffer {
+  public:
+    using Sample = std::pair<Canonical, Policy>;
+
+    // opens path, creating an empty buffer if it does not exist
+    explicit ReplayBuffer(std::string path);
+    ~ReplayBuffer();
+    ReplayBuffer(const ReplayBuffer&) = delete;
+    ReplayBuffer& operator=(const ReplayBuffer&) = delete;
+
+    // durable once this returns
+    void append(uint32_t generation, const std::vector<Sample>& samples);
+
+    // committed records
+    size_t size() const { return committed; }
+    // generation of the last record, 0 when empty
+    uint32_t latest_generation() const;
+    // index of the first record of the last generations generations
+    size_t window_start(uint32_t generations) const;
+
+    // writes record index as a {1, BOARD_SIZE, BOARD_SIZE} board and
+    // BOARD_CELLS policy floats
+    void read(size_t index, float* state, float* policy) const;
+
+  private:
+    struct Record;
+
+    const Record& record(size_t index) const;
+    void write_header();
+    void map();
+
+    std::string path;
+    int fd = -1;
+    size_t committed = 0;
+    const char* mapped = nullptr;
+    size_t mapped_size = 0;
+};
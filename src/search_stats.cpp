@@ -0,0 +1,57 @@
+#include "search_stats.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#include <fmt/color.h>
+#include <fmt/core.h>
+
+namespace {
+double per(int64_t total, int64_t count) {
+    return count > 0 ? static_cast<double>(total) / count : 0.0;
+}
+
+double millis(int64_t ns) { return ns / 1e6; }
+} // namespace
+
+void export_stats(const std::string& fields, const SearchStats& stats) {
+    if constexpr (!SEARCH_STATS) {
+        return;
+    }
+
+    static std::mutex mutex;
+    static FILE* file = [] {
+        const char* path_s = std::getenv("SEARCH_STATS_FILE");
+        std::string path = path_s ? path_s : "search_stats.jsonl";
+        fmt::print("Using search stats file {}\n", path);
+        FILE* opened = std::fopen(path.c_str(), "a");
+        if (opened == nullptr) {
+            fmt::print(stderr, fmt::fg(fmt::color::red),
+                       "Failed to open search stats file {}\n", path);
+        }
+        return opened;
+    }();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file == nullptr) {
+        return;
+    }
+    fmt::print(file,
+               "{{{}, \"queries\": {}, \"iterations\": {}, "
+               "\"playouts_per_sec\": {:.1f}, \"query_ms\": {:.3f}, "
+               "\"phase_ms\": {{\"select\": {:.3f}, \"expand\": {:.3f}, "
+               "\"simulate\": {:.3f}, \"backprop\": {:.3f}}}, "
+               "\"nodes\": {}, \"avg_depth\": {:.2f}, \"max_depth\": {}, "
+               "\"avg_rollout\": {:.2f}, \"solved\": {}, \"unsolved\": {}, "
+               "\"book_hits\": {}}}\n",
+               fields, stats.queries, stats.iterations,
+               per(stats.iterations, stats.query_ns) * 1e9,
+               millis(stats.query_ns), millis(stats.select_ns),
+               millis(stats.expand_ns), millis(stats.simulate_ns),
+               millis(stats.backprop_ns), stats.nodes,
+               per(stats.depth_sum, stats.iterations), stats.max_depth,
+               per(stats.rollout_moves, stats.iterations), stats.solved,
+               stats.unsolved, stats.book_hits);
+    std::fflush(file);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// Search instrumentation is only compiled in with -DMCTS_STATS (the
+// MCTS_STATS CMake option). Without it the counters stay zero, the timers are
+// not compiled and nothing is exported.
+#ifdef MCTS_STATS
+constexpr bool SEARCH_STATS = true;
+#else
+constexpr bool SEARCH_STATS = false;
+#endif
+
+// Counters of one or more Mcts queries. Phase times are summed over the
+// search threads, so with several threads they add up to more than the wall
+// clock time.
+struct SearchStats {
+    int64_t queries = 0;
+    int64_t iterations = 0;
+    int64_t select_ns = 0;
+    int64_t expand_ns = 0;
+    int64_t simulate_ns = 0;
+    int64_t backprop_ns = 0;
+    // wall clock time of the queries
+    int64_t query_ns = 0;
+    // nodes added to the tree
+    int64_t nodes = 0;
+    // depth of the selected leaves below the root
+    int64_t depth_sum = 0;
+    int64_t max_depth = 0;
+    // moves played by the rollouts
+    int64_t rollout_moves = 0;
+    // leaves whose outcome was proven by the solver instead of a rollout
+    int64_t solved = 0;
+    // leaves the solver ran out of budget on
+    int64_t unsolved = 0;
+    // queries answered by the opening book
+    int64_t book_hits = 0;
+
+    SearchStats& operator+=(const SearchStats& rhs) {
+        queries += rhs.queries;
+        iterations += rhs.iterations;
+        select_ns += rhs.select_ns;
+        expand_ns += rhs.expand_ns;
+        simulate_ns += rhs.simulate_ns;
+        backprop_ns += rhs.backprop_ns;
+        query_ns += rhs.query_ns;
+        nodes += rhs.nodes;
+        depth_sum += rhs.depth_sum;
+        max_depth = std::max(max_depth, rhs.max_depth);
+        rollout_moves += rhs.rollout_moves;
+        solved += rhs.solved;
+        unsolved += rhs.unsolved;
+        book_hits += rhs.book_hits;
+        return *this;
+    }
+};
+
+// Appends {<fields>, <stats>} as one line to SEARCH_STATS_FILE
+// (search_stats.jsonl by default). fields are the leading JSON members, e.g.
+// "\"scope\": \"game\", \"game\": 3". Thread-safe, and a no-op without
+// MCTS_STATS.
+void export_stats(const std::string& fields, const SearchStats& stats);
@@ -0,0 +1,135 @@
+#include "solver.hpp"
+
+#include <algorithm>
+
+Solver::Solver(size_t table_size) {
+    size_t size = 1;
+    while (size < table_size) {
+        size *= 2;
+    }
+    table.resize(size);
+    mask = size - 1;
+}
+
+std::optional<Solver::Result> Solver::solve(const State& state,
+                                            uint64_t max_nodes) {
+    if (state.get_winner().has_value()) {
+        // the last move won, so the player to move has lost
+        return Result{LOSS, -1, 0};
+    }
+    if (state.is_ended()) {
+        return Result{DRAW, -1, 0};
+    }
+
+    nodes = 0;
+    this->max_nodes = max_nodes;
+    aborted = false;
+    int cell = -1;
+    int value = negamax(state, LOSS, WIN, cell);
+    if (aborted) {
+        return std::nullopt;
+    }
+    return Result{value, cell, nodes};
+}
+
+int Solver::negamax(const State& state, int alpha, int beta, int& best_cell) {
+    if (nodes >= max_nodes) {
+        aborted = true;
+        return DRAW;
+    }
+    nodes += 1;
+
+    Bitboard empty = state.get_empty();
+    if (empty == 0) {
+        return DRAW;
+    }
+    Player me = state.get_next();
+    Bitboard wins = state.winning_cells(me);
+    if (wins != 0) {
+        best_cell = lowest_cell(wins);
+        return WIN;
+    }
+    // two threats can't both be blocked, one has to be
+    Bitboard threats = state.winning_cells(!me);
+    if (bit_count(threats) >= 2) {
+        best_cell = lowest_cell(threats);
+        return LOSS;
+    }
+    if (threats == 0 && !state.can_win(me) && !state.can_win(!me)) {
+        // no window can be completed anymore
+        best_cell = lowest_cell(empty);
+        return DRAW;
+    }
+
+    Entry& entry = table[state.get_hash() & mask];
+    int table_cell = -1;
+    if (entry.bound != Empty && entry.key == state.get_hash()) {
+        table_cell = entry.cell;
+        if (entry.bound == Exact) {
+            best_cell = entry.cell;
+            return entry.value;
+        } else if (entry.bound == Lower) {
+            alpha = std::max(alpha, static_cast<int>(entry.value));
+        } else {
+            beta = std::min(beta, static_cast<int>(entry.value));
+        }
+        if (alpha >= beta) {
+            best_cell = entry.cell;
+            return entry.value;
+        }
+    }
+
+    // the table move first, then by history
+    std::array<int, BOARD_CELLS> cells;
+    int count = 0;
+    const auto& scores = history[me == Player::Black];
+    for (Bitboard rest = (threats != 0) ? threats : empty; rest != 0;
+         rest &= rest - 1) {
+        int cell = lowest_cell(rest);
+        int n = count;
+        count += 1;
+        // insertion sort, as there are at most BOARD_CELLS moves
+        while (n > 0 &&
+               (cell == table_cell || (cells[n - 1] != table_cell &&
+                                       scores[cell] > scores[cells[n - 1]]))) {
+            cells[n] = cells[n - 1];
+            n -= 1;
+        }
+        cells[n] = cell;
+    }
+
+    int original_alpha = alpha;
+    int best = LOSS - 1;
+    for (int k = 0; k < count; k += 1) {
+        State child{state};
+        child.place(Action::from_cell(cells[k]));
+        // no move wins here, so the child is either open or a draw
+        int reply = -1;
+        int value = -negamax(child, -beta, -alpha, reply);
+        if (aborted) {
+            return DRAW;
+        }
+        if (value > best) {
+            best = value;
+            best_cell = cells[k];
+        }
+        alpha = std::max(alpha, value);
+        if (alpha >= beta) {
+            int depth = bit_count(empty);
+            history[me == Player::Black][cells[k]] += depth * depth;
+            break;
+        }
+    }
+
+    entry.key = state.get_hash();
+    entry.value = static_cast<int8_t>(best);
+    entry.cell = static_cast<int16_t>(best_cell);
+    if (best <= original_alpha) {
+        entry.bound = Upper;
+    } else if (best >= beta) {
+        entry.bound = Lower;
+    } else {
+        entry.bound = Exact;
+    }
+    return best;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "game.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Exact solver for positions close to the end of the game: negamax with
+// alpha-beta over the outcomes win, draw and loss. Moves are ordered by the
+// table, by forced replies to immediate threats, and by a history of moves
+// that caused cutoffs. Solved positions stay in the table across calls, so
+// one solver should be kept per thread and reused.
+class Solver {
+  public:
+    // values from the view of the player to move
+    static constexpr int WIN = 1;
+    static constexpr int DRAW = 0;
+    static constexpr int LOSS = -1;
+
+    struct Result {
+        int value;
+        // a move reaching value, -1 if the game is over
+        int cell;
+        // positions searched by this call
+        uint64_t nodes;
+    };
+
+    // table of at least table_size entries
+    explicit Solver(size_t table_size = size_t{1} << 16);
+
+    // nullopt if the position couldn't be solved within max_nodes
+    std::optional<Result> solve(const State& state, uint64_t max_nodes);
+    // positions searched by the last call, whether it succeeded or not
+    uint64_t last_nodes() const { return nodes; }
+
+  private:
+    enum Bound : uint8_t { Empty, Exact, Lower, Upper };
+    struct Entry {
+        uint64_t key = 0;
+        int8_t value = 0;
+        Bound bound = Empty;
+        // wide enough for every cell of a 15x15 board
+        int16_t cell = -1;
+    };
+
+    int negamax(const State& state, int alpha, int beta, int& best_cell);
+
+    std::vector<Entry> table;
+    size_t mask;
+    // cutoffs caused by each cell, per player to move
+    std::array<std::array<uint32_t, BOARD_CELLS>, 2> history{};
+    uint64_t nodes = 0;
+    uint64_t max_nodes = 0;
+    bool aborted = false;
+};
@@ -1,4 +1,5 @@
 #include "tensor_utils.hpp"
+#include "game.hpp"
 
 #include <algorithm>
 #include <fmt/core.h>
@@ -18,9 +19,9 @@ float value_from_tensor(torch::Tensor tensor) {
 }
 
 void show_policy(Policy policy) {
-    for (int i = 0; i < 36; i += 1) {
+    for (int i = 0; i < BOARD_CELLS; i += 1) {
         fmt::print("{:8.2}", policy[i]);
-        if ((i + 1) % 6 == 0) {
+        if ((i + 1) % BOARD_SIZE == 0) {
             fmt::print("\n");
         } else {
             fmt::print(", ");
@@ -29,32 +30,39 @@ void show_policy(Policy policy) {
 }
 
 void show_canonical(Canonical canonical) {
-    for (int i = 0; i < 6; i += 1) {
+    for (int i = 0; i < BOARD_SIZE; i += 1) {
         fmt::print("{:8.2}\n", fmt::join(canonical[i], ", "));
     }
 }
 
-std::vector<std::pair<Canonical, Policy>> augment(Canonical state,
-                                                  Policy policy) {
-    std::vector<std::pair<Canonical, Policy>> pairs;
-    pairs.push_back({state, policy});
-
-    for (int rot = 1; rot < 3; rot += 1) {
-        auto& [last_state, last_policy] = pairs.back();
-        Canonical augmented_state{};
-        Policy augmented_policy{};
-
-        // counter 90
-        for (int i = 0; i < 6; i += 1) {
-            for (int j = 0; j < 6; j += 1) {
-                augmented_state[i][j] = last_state[j][6 - 1 - i];
-                augmented_policy[i * 6 + j] =
-                    last_policy[(j * 6) + (6 - 1 - i)];
-            }
+torch::Tensor symmetry_indices(torch::Device device) {
+    std::vector<int64_t> indices(SYMMETRIES * BOARD_CELLS);
+    for (int s = 0; s < SYMMETRIES; s += 1) {
+        for (int cell = 0; cell < BOARD_CELLS; cell += 1) {
+            indices[s * BOARD_CELLS + transform_cell(s, cell)] = cell;
         }
+    }
+    return torch::tensor(indices, torch::kLong)
+        .view({SYMMETRIES, BOARD_CELLS})
+        .to(device);
+}
 
-        pairs.push_back({augmented_state, augmented_policy});
+std::pair<torch::Tensor, torch::Tensor> augment(torch::Tensor states,
+                                                torch::Tensor policies,
+                                                torch::Tensor indices,
+                                                bool full) {
+    int64_t batch = states.size(0);
+    auto flat = states.reshape({batch, BOARD_CELLS});
+    if (full) {
+        auto all = indices.view({-1});
+        int64_t augmented = batch * SYMMETRIES;
+        return {flat.index_select(1, all)
+                    .view({augmented, 1, BOARD_SIZE, BOARD_SIZE}),
+                policies.index_select(1, all).view({augmented, BOARD_CELLS})};
     }
 
-    return pairs;
+    auto chosen = torch::randint(SYMMETRIES, {batch}, indices.options());
+    auto gather = indices.index_select(0, chosen);
+    return {flat.gather(1, gather).view({batch, 1, BOARD_SIZE, BOARD_SIZE}),
+            policies.gather(1, gather)};
 }
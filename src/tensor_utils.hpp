@@ -1,10 +1,12 @@
 #pragma once
+#include "game.hpp"
+
 #include <array>
 
 #include <torch/torch.h>
 
-using Policy = std::array<float, 36>;
-using Canonical = std::array<std::array<float, 6>, 6>;
+using Policy = std::array<float, BOARD_CELLS>;
+using Canonical = std::array<std::array<float, BOARD_SIZE>, BOARD_SIZE>;
 
 Policy policy_from_tensor(torch::Tensor tensor);
 float value_from_tensor(torch::Tensor tensor);
@@ -12,5 +14,13 @@ void show_policy(Policy policy);
 void show_canonical(Canonical canonical);
 void show_iters();
 
-std::vector<std::pair<Canonical, Policy>> augment(Canonical state,
-                                                  Policy policy);
+// {SYMMETRIES, BOARD_CELLS} indices, row s gathers a flat board or policy
+// transformed by symmetry s
+torch::Tensor symmetry_indices(torch::Device device);
+// states {batch, 1, BOARD_SIZE, BOARD_SIZE} and policies
+// {batch, BOARD_CELLS} under a random symmetry per sample, or under all of
+// them when full, which multiplies the batch by SYMMETRIES
+std::pair<torch::Tensor, torch::Tensor> augment(torch::Tensor states,
+                                                torch::Tensor policies,
+                                                torch::Tensor indices,
+                                                bool full);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <fmt/core.h>
+
+// Minimal assertions for the test executables. Failures are printed and
+// counted, and main returns the count so that ctest sees them.
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__,          \
+                       __LINE__, #condition);                                  \
+            check_failures += 1;                                               \
+        }                                                                      \
+    } while (false)
@@ -0,0 +1,69 @@
+#include "check.hpp"
+#include "mcts.hpp"
+#include "solver.hpp"
+
+#include <algorithm>
+
+namespace {
+// White to move, Black completes five in row 0 at either end
+State double_threat() {
+    State state{};
+    const int moves[][2] = {
+        {BOARD_SIZE - 1, 0}, {0, 1}, {BOARD_SIZE - 1, 2}, {0, 2},
+        {BOARD_SIZE - 2, 1}, {0, 3}, {BOARD_SIZE - 2, 3}, {0, 4},
+    };
+    for (const auto& move : moves) {
+        state.place(Action(move[0], move[1]));
+    }
+    return state;
+}
+
+// positions the solver proves lost for the player to move, close to the end
+std::vector<State> lost_endgames(int count) {
+    Rng rng{1};
+    Solver solver{};
+    std::vector<State> found{};
+    while (static_cast<int>(found.size()) < count) {
+        State state{};
+        while (!state.is_ended() &&
+               bit_count(state.get_empty()) > default_solve_empty()) {
+            state.place(Action::from_cell(
+                nth_cell(state.get_empty(),
+                         rng.below(bit_count(state.get_empty())))));
+        }
+        auto result = solver.solve(state, ~uint64_t{0});
+        if (!state.is_ended() && bit_count(state.get_empty()) >= 3 &&
+            result->value == Solver::LOSS) {
+            found.push_back(state);
+        }
+    }
+    return found;
+}
+
+// A root lost in every line has to end the search, and the policy must not
+// pile up on the first cell, which selection falls back to once every move
+// is refuted.
+void check_lost_root(const State& state) {
+    Mcts mcts{1};
+    mcts.seed(7);
+    mcts.set_book(nullptr);
+    mcts.set_iters(50000);
+    auto [action, policy] = mcts.query(state);
+
+    CHECK(has_cell(state.get_empty(), action.cell()));
+    float top = *std::max_element(policy.begin(), policy.end());
+    CHECK(top < 0.5f);
+    CHECK(policy[lowest_cell(state.get_empty())] < 0.5f);
+    if constexpr (SEARCH_STATS) {
+        CHECK(mcts.last_stats().iterations < 50000);
+    }
+}
+} // namespace
+
+int main() {
+    check_lost_root(double_threat());
+    for (const State& state : lost_endgames(20)) {
+        check_lost_root(state);
+    }
+    return check_failures;
+}
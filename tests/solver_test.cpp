@@ -0,0 +1,74 @@
+#include "check.hpp"
+#include "solver.hpp"
+
+#include <vector>
+
+static_assert(BOARD_SIZE == 15, "built for 15x15, see CMakeLists.txt");
+
+namespace {
+// White to move on an almost full board. Black completes row 12 at the only
+// cell White can play, 189. No other line can be completed.
+const char* const BOARD[BOARD_SIZE] = {
+    "WBWWBBWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BB.W.BWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWBBWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWBBWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWBBWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWBBWWBBWWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWWBBBB.WWBBW", //
+    "WWBBWWBBWWBBWWB", //
+    "BBWWBBWWBBWWBBW", //
+};
+constexpr int FORCED = 12 * BOARD_SIZE + 9;
+
+State from_board() {
+    std::vector<Action> white{};
+    std::vector<Action> black{};
+    for (int i = 0; i < BOARD_SIZE; i += 1) {
+        for (int j = 0; j < BOARD_SIZE; j += 1) {
+            if (BOARD[i][j] == 'W') {
+                white.emplace_back(i, j);
+            } else if (BOARD[i][j] == 'B') {
+                black.emplace_back(i, j);
+            }
+        }
+    }
+    State state{};
+    for (size_t n = 0; n < white.size(); n += 1) {
+        state.place(white[n]);
+        state.place(black[n]);
+    }
+    return state;
+}
+
+// The table has to hand back cells above 127 as they were stored.
+void check_table_cell() {
+    State state = from_board();
+    CHECK(state.get_next() == Player::White);
+    CHECK(!state.get_winner().has_value());
+    CHECK(state.winning_cells(Player::White) == 0);
+    CHECK(state.winning_cells(Player::Black) ==
+          cell_bit<Bitboard>(FORCED));
+
+    Solver solver{};
+    // searched, then answered from the table
+    for (int k = 0; k < 2; k += 1) {
+        auto result = solver.solve(state, 100000);
+        CHECK(result.has_value());
+        if (result.has_value()) {
+            CHECK(result->cell == FORCED);
+        }
+    }
+}
+} // namespace
+
+int main() {
+    check_table_cell();
+    return check_failures;
+}